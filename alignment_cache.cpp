@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include "alignment_cache.hpp"
+
+GapAlignmentCache::GapAlignmentCache(size_t capacity_bytes, size_t shard_count)
+    : shards_(std::max<size_t>(shard_count, 1)), shard_capacity_(capacity_bytes / shards_.size()) {}
+
+uint64_t GapAlignmentCache::make_key(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant) {
+    uint64_t key = std::hash<std::string_view>()(query);
+    const uint64_t params[] = {std::hash<std::string_view>()(ref), query.length(), variant,
+                               uint64_t(uint8_t(scoring_params.match)) | uint64_t(uint8_t(scoring_params.mismatch)) << 8 |
+                               uint64_t(uint8_t(scoring_params.gap_open)) << 16 | uint64_t(uint8_t(scoring_params.gap_extend)) << 24};
+    for (uint64_t param : params) {
+        key ^= param + 0x9e3779b97f4a7c15ULL + (key << 6) + (key >> 2);
+    }
+    return key;
+}
+
+size_t GapAlignmentCache::Entry::memory_bytes() const {
+    // Node of the list, node of the index and the heap blocks of the entry.
+    return sizeof(Entry) + 4 * sizeof(void*) + sizeof(uint64_t) + bases.capacity() + cigar.capacity() * sizeof(uint32_t);
+}
+
+std::list<GapAlignmentCache::Entry>::iterator GapAlignmentCache::locate(
+    Shard& shard, uint64_t key, std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant) {
+    auto [begin, end] = shard.index.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+        const Entry& entry = *it->second;
+        const std::string_view bases = entry.bases;
+        if (entry.query_length == query.length() && bases.substr(0, entry.query_length) == query && bases.substr(entry.query_length) == ref &&
+            entry.variant == variant && entry.scoring.match == scoring_params.match && entry.scoring.mismatch == scoring_params.mismatch &&
+            entry.scoring.gap_open == scoring_params.gap_open && entry.scoring.gap_extend == scoring_params.gap_extend) {
+            return it->second;
+        }
+    }
+    return shard.lru.end();
+}
+
+bool GapAlignmentCache::find(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant,
+                             Span& span, std::vector<OpLen>& ops) {
+    const uint64_t key = make_key(query, ref, scoring_params, variant);
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto entry = locate(s, key, query, ref, scoring_params, variant);
+    if (entry == s.lru.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    s.lru.splice(s.lru.begin(), s.lru, entry);
+    span = entry->span;
+    for (uint32_t word : entry->cigar) {
+        ops.push_back({static_cast<Operation>(word & 7), word >> 3});
+    }
+    return true;
+}
+
+void GapAlignmentCache::insert(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant,
+                               const Span& span, const OpLen* begin, const OpLen* end) {
+    const uint64_t key = make_key(query, ref, scoring_params, variant);
+    Entry entry = {key, static_cast<uint32_t>(query.length()), std::string(query), scoring_params, variant, span, {}};
+    entry.bases.append(ref);
+    entry.cigar.reserve(end - begin);
+    for (const OpLen* op = begin; op != end; ++op) {
+        entry.cigar.push_back(static_cast<uint32_t>(op->len << 3 | static_cast<uint32_t>(op->op)));
+    }
+    const size_t bytes = entry.memory_bytes();
+    if (bytes > shard_capacity_) return;
+
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (locate(s, key, query, ref, scoring_params, variant) != s.lru.end()) return;
+    s.lru.push_front(std::move(entry));
+    s.index.emplace(key, s.lru.begin());
+    s.bytes += bytes;
+    while (s.bytes > shard_capacity_) {
+        const auto oldest = std::prev(s.lru.end());
+        auto [first, last] = s.index.equal_range(oldest->key);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == oldest) {
+                s.index.erase(it);
+                break;
+            }
+        }
+        s.bytes -= oldest->memory_bytes();
+        s.lru.erase(oldest);
+    }
+}
+
+double GapAlignmentCache::hit_rate() const {
+    const size_t lookups = hits() + misses();
+    return lookups == 0 ? 0.0 : double(hits()) / lookups;
+}
+
+size_t GapAlignmentCache::memory_bytes() const {
+    size_t bytes = 0;
+    for (const Shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        bytes += s.bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,81 @@
+#ifndef GAP_ALIGNMENT_CACHE_H
+#define GAP_ALIGNMENT_CACHE_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "baligner.hpp"
+
+// Memo of small alignments that come up again and again across reads, such
+// as the gaps between anchors in repeats and homopolymers. An entry keeps the
+// score, the aligned span and the CIGAR packed into 32-bit words, and is found
+// by a hash of both sequences, the scoring and a `variant` that tells apart
+// alignments of the same pair that can differ (mode, block settings). Hits
+// are confirmed against the stored sequences. The cache is split into shards,
+// each with its own lock and least-recently-used eviction, so workers sharing
+// it through AlignmentPolicy::alignment_cache rarely wait on each other.
+class GapAlignmentCache {
+public:
+    struct Span {
+        int score;
+        uint32_t query_start;
+        uint32_t query_end;
+        uint32_t ref_start;
+        uint32_t ref_end;
+    };
+
+    explicit GapAlignmentCache(size_t capacity_bytes = size_t(64) << 20, size_t shard_count = 64);
+    GapAlignmentCache(const GapAlignmentCache&) = delete;
+    GapAlignmentCache& operator=(const GapAlignmentCache&) = delete;
+
+    // On a hit, fills `span` and appends the CIGAR to `ops`.
+    bool find(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant,
+              Span& span, std::vector<OpLen>& ops);
+    void insert(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant,
+                const Span& span, const OpLen* begin, const OpLen* end);
+
+    size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    double hit_rate() const;
+    size_t memory_bytes() const;
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t query_length;
+        // Query then reference bases.
+        std::string bases;
+        AlignmentScoring scoring;
+        uint64_t variant;
+        Span span;
+        // Length << 3 | op.
+        std::vector<uint32_t> cigar;
+
+        size_t memory_bytes() const;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> lru;
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    static uint64_t make_key(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, uint64_t variant);
+    static std::list<Entry>::iterator locate(Shard& shard, uint64_t key, std::string_view query, std::string_view ref,
+                                             const AlignmentScoring& scoring_params, uint64_t variant);
+    Shard& shard(uint64_t key) { return shards_[key % shards_.size()]; }
+
+    std::vector<Shard> shards_;
+    size_t shard_capacity_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+};
+
+#endif
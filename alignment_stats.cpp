@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "alignment_stats.hpp"
+#include "format.hpp"
+
+namespace {
+
+const char* const kStageNames[] = {
+    "prefix",
+    "inner_gaps",
+    "indel_shortcut",
+    "suffix",
+    "block_global",
+    "block_free_query_end",
+    "block_free_query_start",
+    "reseed",
+};
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == static_cast<size_t>(AlignmentStage::Count));
+
+// Live per-thread counters plus the sum of those of exited threads.
+struct StatsRegistry {
+    std::mutex mutex;
+    std::vector<AlignmentStats*> live;
+    AlignmentStats retired;
+};
+
+StatsRegistry& registry() {
+    static StatsRegistry instance;
+    return instance;
+}
+
+struct ThreadStats {
+    AlignmentStats stats;
+
+    ThreadStats() {
+        StatsRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.live.push_back(&stats);
+    }
+    ~ThreadStats() {
+        StatsRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.retired.merge(stats);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), &stats));
+    }
+};
+
+void append_histogram(std::string& out, const LengthHistogram& histogram) {
+    out += '[';
+    bool first = true;
+    for (size_t b = 0; b < LengthHistogram::kBuckets; b++) {
+        if (histogram.counts[b] == 0) continue;
+        if (!first) out += ',';
+        first = false;
+        const uint64_t min = b == 0 ? 0 : uint64_t(1) << (b - 1);
+        const uint64_t max = b == 0 ? 0 : (uint64_t(1) << b) - 1;
+        out += "{\"min\":";
+        append_uint(out, min);
+        out += ",\"max\":";
+        append_uint(out, max);
+        out += ",\"count\":";
+        append_uint(out, histogram.counts[b]);
+        out += '}';
+    }
+    out += ']';
+}
+
+}
+
+void LengthHistogram::add(uint64_t value) {
+    size_t bucket = 0;
+    while (bucket + 1 < kBuckets && value >= (uint64_t(1) << bucket)) bucket++;
+    counts[bucket]++;
+}
+
+void AlignmentStats::merge(const AlignmentStats& other) {
+    for (size_t s = 0; s < static_cast<size_t>(AlignmentStage::Count); s++) {
+        stages[s].calls += other.stages[s].calls;
+        stages[s].cells += other.stages[s].cells;
+        stages[s].nanoseconds += other.stages[s].nanoseconds;
+    }
+    for (size_t b = 0; b < LengthHistogram::kBuckets; b++) {
+        gap_lengths.counts[b] += other.gap_lengths.counts[b];
+        length_diffs.counts[b] += other.length_diffs.counts[b];
+    }
+}
+
+std::string AlignmentStats::to_json() const {
+    std::string out = "{\"stages\":{";
+    for (size_t s = 0; s < static_cast<size_t>(AlignmentStage::Count); s++) {
+        if (s > 0) out += ',';
+        out += '"';
+        out += kStageNames[s];
+        out += "\":{\"calls\":";
+        append_uint(out, stages[s].calls);
+        out += ",\"cells\":";
+        append_uint(out, stages[s].cells);
+        out += ",\"nanoseconds\":";
+        append_uint(out, stages[s].nanoseconds);
+        out += '}';
+    }
+    out += "},\"gap_lengths\":";
+    append_histogram(out, gap_lengths);
+    out += ",\"length_diffs\":";
+    append_histogram(out, length_diffs);
+    out += "}\n";
+    return out;
+}
+
+AlignmentStats& thread_alignment_stats() {
+    thread_local ThreadStats thread_stats;
+    return thread_stats.stats;
+}
+
+AlignmentStats collect_alignment_stats() {
+    StatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    AlignmentStats total = r.retired;
+    for (const AlignmentStats* stats : r.live) total.merge(*stats);
+    return total;
+}
+
+void reset_alignment_stats() {
+    StatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.retired = AlignmentStats();
+    for (AlignmentStats* stats : r.live) *stats = AlignmentStats();
+}
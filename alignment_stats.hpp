@@ -0,0 +1,98 @@
+#ifndef ALIGNMENT_STATS_H
+#define ALIGNMENT_STATS_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Hot-path statistics, only collected when built with -DPIECEWISE_STATS
+// (make STATS=1). Every thread fills its own counters without locking; they are
+// merged by collect_alignment_stats(). Without the flag the PIECEWISE_STAT_*
+// macros expand to nothing and their arguments are never evaluated.
+
+enum class AlignmentStage {
+    Prefix,
+    InnerGaps,
+    IndelShortcut,
+    Suffix,
+    BlockGlobal,
+    BlockFreeQueryEnd,
+    BlockFreeQueryStart,
+    Reseed,
+    Count
+};
+
+struct StageStats {
+    uint64_t calls = 0;
+    uint64_t cells = 0;
+    uint64_t nanoseconds = 0;
+};
+
+// Power-of-two buckets: bucket 0 counts zeros, bucket b counts [2^(b-1), 2^b).
+struct LengthHistogram {
+    static constexpr size_t kBuckets = 33;
+    uint64_t counts[kBuckets] = {};
+
+    void add(uint64_t value);
+};
+
+struct AlignmentStats {
+    StageStats stages[static_cast<size_t>(AlignmentStage::Count)];
+    LengthHistogram gap_lengths;
+    LengthHistogram length_diffs;
+
+    StageStats& stage(AlignmentStage s) { return stages[static_cast<size_t>(s)]; }
+    void merge(const AlignmentStats& other);
+    std::string to_json() const;
+};
+
+// Counters of the calling thread.
+AlignmentStats& thread_alignment_stats();
+
+// Sum over all threads, including those that have exited. Only consistent
+// while no thread is aligning, e.g. after WorkStealingPool::wait.
+AlignmentStats collect_alignment_stats();
+void reset_alignment_stats();
+
+// Adds the elapsed time, one call and `cells` to a stage when it goes out of
+// scope. Nested stages each count their own full time, e.g. the prefix stage
+// includes its block_free_query_start call. The inner_gaps stage counts one
+// call per batch; the gaps themselves are counted by the histograms.
+class StageTimer {
+public:
+    StageTimer(AlignmentStage stage, uint64_t cells) : stage_(stage), cells_(cells), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        StageStats& stats = thread_alignment_stats().stage(stage_);
+        stats.calls++;
+        stats.cells += cells_;
+        stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    AlignmentStage stage_;
+    uint64_t cells_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline void record_gap(size_t query_len, size_t ref_len) {
+    AlignmentStats& stats = thread_alignment_stats();
+    stats.gap_lengths.add(query_len > ref_len ? query_len : ref_len);
+    stats.length_diffs.add(query_len > ref_len ? query_len - ref_len : ref_len - query_len);
+}
+
+#define PIECEWISE_STAT_CONCAT_INNER(a, b) a##b
+#define PIECEWISE_STAT_CONCAT(a, b) PIECEWISE_STAT_CONCAT_INNER(a, b)
+
+#ifdef PIECEWISE_STATS
+#define PIECEWISE_STATS_ENABLED 1
+#define PIECEWISE_STAT_SCOPE(stage, cells) StageTimer PIECEWISE_STAT_CONCAT(stage_timer_, __LINE__)(stage, cells)
+#define PIECEWISE_STAT_GAP(query_len, ref_len) record_gap(query_len, ref_len)
+#else
+#define PIECEWISE_STATS_ENABLED 0
+#define PIECEWISE_STAT_SCOPE(stage, cells)
+#define PIECEWISE_STAT_GAP(query_len, ref_len)
+#endif
+
+#endif
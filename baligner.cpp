@@ -1,9 +1,17 @@
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <limits>
+#include <memory>
+#include <utility>
 #include "block_aligner.h"
+#include "alignment_cache.hpp"
+#include "alignment_stats.hpp"
 #include "baligner.hpp"
+#include "format.hpp"
+#include "reference_cache.hpp"
 
 std::vector<OpLen> build_cigar_vector(const Cigar* cigar, size_t cigar_len) {
     std::vector<OpLen> cigar_vec;
@@ -23,46 +31,575 @@ std::vector<OpLen> reverse_cigar_vector(const Cigar* cigar, size_t cigar_len) {
     return reversed_cigar_vec;
 }
 
-std::string reverse_string(const std::string& s) {
-    std::string temp = s;
-    std::reverse(temp.begin(), temp.end());
-    return temp;
+CigarBuilder::~CigarBuilder() {
+    if (ops_) resource_->deallocate(ops_, (capacity_end_ - ops_) * sizeof(OpLen), alignof(OpLen));
 }
 
-std::string AlignmentResult::to_cigar_string() const {
-    std::string result;
-    for (const auto& elem : cigar) {
-        result += std::to_string(elem.len);
-        switch (elem.op) {
+CigarBuilder::CigarBuilder(CigarBuilder&& other) noexcept
+    : resource_(other.resource_),
+      ops_(std::exchange(other.ops_, nullptr)),
+      end_(std::exchange(other.end_, nullptr)),
+      capacity_end_(std::exchange(other.capacity_end_, nullptr)) {}
+
+CigarBuilder& CigarBuilder::operator=(CigarBuilder&& other) noexcept {
+    if (this != &other) {
+        if (ops_) resource_->deallocate(ops_, (capacity_end_ - ops_) * sizeof(OpLen), alignof(OpLen));
+        resource_ = other.resource_;
+        ops_ = std::exchange(other.ops_, nullptr);
+        end_ = std::exchange(other.end_, nullptr);
+        capacity_end_ = std::exchange(other.capacity_end_, nullptr);
+    }
+    return *this;
+}
+
+void CigarBuilder::reserve(size_t capacity) {
+    const size_t old_capacity = capacity_end_ - ops_;
+    if (capacity <= old_capacity) return;
+    capacity = std::max({capacity, 2 * old_capacity, size_t(16)});
+    OpLen* ops = static_cast<OpLen*>(resource_->allocate(capacity * sizeof(OpLen), alignof(OpLen)));
+    OpLen* end = std::copy(ops_, end_, ops);
+    if (ops_) resource_->deallocate(ops_, old_capacity * sizeof(OpLen), alignof(OpLen));
+    ops_ = ops;
+    end_ = end;
+    capacity_end_ = ops + capacity;
+}
+
+void CigarBuilder::append(const OpLen* begin, const OpLen* end) {
+    if (begin == end) return;
+    push(begin->op, begin->len);
+    reserve(size() + (end - begin - 1));
+    end_ = std::copy(begin + 1, end, end_);
+}
+
+void CigarBuilder::append(const Cigar* cigar, bool reversed) {
+    const size_t len = block_len_cigar(cigar);
+    if (len == 0) return;
+    OpLen first = block_get_cigar(cigar, reversed ? len - 1 : 0);
+    push(first.op, first.len);
+    reserve(size() + len - 1);
+    for (size_t i = 1; i < len; i++) {
+        *end_++ = block_get_cigar(cigar, reversed ? len - 1 - i : i);
+    }
+}
+
+void CigarBuilder::rollback(const Checkpoint& checkpoint) {
+    end_ = ops_ + checkpoint.size;
+    if (!empty()) end_[-1].len = checkpoint.last_len;
+}
+
+void append_cigar_string(std::string& out, const OpLen* begin, const OpLen* end) {
+    for (const OpLen* elem = begin; elem != end; ++elem) {
+        append_uint(out, elem->len);
+        if (elem->op == kSoftClip) {
+            out += 'S';
+            continue;
+        }
+        switch (elem->op) {
             case Operation::M:
-                result += 'M';
+                out += 'M';
                 break;
             case Operation::Eq:
-                result += '=';
+                out += '=';
                 break;
             case Operation::I:
-                result += 'I';
+                out += 'I';
                 break;
             case Operation::D:
-                result += 'D';
+                out += 'D';
                 break;
             case Operation::X:
-                result += 'X';
+                out += 'X';
                 break;
             case Operation::Sentinel:
                 break;
         }
     }
+}
+
+std::string AlignmentResult::to_cigar_string() const {
+    std::string result;
+    result.reserve(cigar.size() * 4);
+    append_cigar_string(result, cigar.data(), cigar.data() + cigar.size());
     return result;
 }
 
-enum class AlignmentMode {
-    Global,
-    FreeQueryEnd,
-    FreeQueryStart
+BlockAlignerWorkspace::~BlockAlignerWorkspace() {
+    release();
+}
+
+BlockAlignerWorkspace::BlockAlignerWorkspace(BlockAlignerWorkspace&& other) noexcept : cigar_builder_(other.cigar_builder_.resource()) {
+    *this = std::move(other);
+}
+
+BlockAlignerWorkspace& BlockAlignerWorkspace::operator=(BlockAlignerWorkspace&& other) noexcept {
+    if (this != &other) {
+        release();
+        policy_ = other.policy_;
+        matrix_ = std::exchange(other.matrix_, nullptr);
+        matrix_match_ = other.matrix_match_;
+        matrix_mismatch_ = other.matrix_mismatch_;
+        query_ = std::exchange(other.query_, {});
+        ref_ = std::exchange(other.ref_, {});
+        global_ = std::exchange(other.global_, {});
+        xdrop_ = std::exchange(other.xdrop_, {});
+        global_trace_ = std::exchange(other.global_trace_, {});
+        xdrop_trace_ = std::exchange(other.xdrop_trace_, {});
+        cigar_builder_ = std::move(other.cigar_builder_);
+        cigar_ = std::exchange(other.cigar_, nullptr);
+        cigar_query_len_ = std::exchange(other.cigar_query_len_, 0);
+        cigar_ref_len_ = std::exchange(other.cigar_ref_len_, 0);
+        batch_ = std::move(other.batch_);
+        unpack_ = std::move(other.unpack_);
+        strand_ = std::move(other.strand_);
+        origins_ = std::move(other.origins_);
+    }
+    return *this;
+}
+
+const ReferenceOrigin* BlockAlignerWorkspace::reference_origin(std::string_view ref) const {
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(ref.data());
+    auto it = std::upper_bound(origins_.begin(), origins_.end(), begin, [](uintptr_t address, const ReferenceOrigin& origin) {
+        return address < reinterpret_cast<uintptr_t>(origin.bases.data());
+    });
+    // Views into one mapping can overlap, so an origin starting further back
+    // may be the one that reaches far enough.
+    while (it != origins_.begin()) {
+        --it;
+        const uintptr_t origin_begin = reinterpret_cast<uintptr_t>(it->bases.data());
+        if (begin + ref.length() <= origin_begin + it->bases.length()) return &*it;
+    }
+    return nullptr;
+}
+
+void BlockAlignerWorkspace::release() {
+    if (matrix_) block_free_aamatrix(matrix_);
+    if (query_.bytes) block_free_padded_aa(query_.bytes);
+    if (ref_.bytes) block_free_padded_aa(ref_.bytes);
+    if (global_.handle) block_free_aa(global_.handle);
+    if (xdrop_.handle) block_free_aa_xdrop(xdrop_.handle);
+    if (global_trace_.handle) block_free_aa_trace(global_trace_.handle);
+    if (xdrop_trace_.handle) block_free_aa_trace_xdrop(xdrop_trace_.handle);
+    if (cigar_) block_free_cigar(cigar_);
+    matrix_ = nullptr;
+    query_ = {};
+    ref_ = {};
+    global_ = {};
+    xdrop_ = {};
+    global_trace_ = {};
+    xdrop_trace_ = {};
+    cigar_ = nullptr;
+    cigar_query_len_ = 0;
+    cigar_ref_len_ = 0;
+}
+
+const AAMatrix* BlockAlignerWorkspace::matrix(const AlignmentScoring& scoring_params) {
+    if (!matrix_ || matrix_match_ != scoring_params.match || matrix_mismatch_ != scoring_params.mismatch) {
+        if (matrix_) block_free_aamatrix(matrix_);
+        matrix_ = block_new_simple_aamatrix(scoring_params.match, scoring_params.mismatch);
+        matrix_match_ = scoring_params.match;
+        matrix_mismatch_ = scoring_params.mismatch;
+    }
+    return matrix_;
+}
+
+PaddedBytes* BlockAlignerWorkspace::grow(PaddedBuffer& buffer, size_t len, size_t block_size) {
+    if (!buffer.bytes || len > buffer.len || block_size > buffer.block_size) {
+        if (buffer.bytes) block_free_padded_aa(buffer.bytes);
+        buffer.len = std::max(len, buffer.len);
+        buffer.block_size = std::max(block_size, buffer.block_size);
+        buffer.bytes = block_new_padded_aa(buffer.len, buffer.block_size);
+    }
+    return buffer.bytes;
+}
+
+PaddedBytes* BlockAlignerWorkspace::query_padded(size_t len, size_t block_size) {
+    return grow(query_, len, block_size);
+}
+
+PaddedBytes* BlockAlignerWorkspace::ref_padded(size_t len, size_t block_size) {
+    return grow(ref_, len, block_size);
+}
+
+BlockHandle BlockAlignerWorkspace::grow(AlignerBlock& block, size_t query_len, size_t ref_len, size_t block_size, BlockNew block_new, BlockFree block_free) {
+    if (!block.handle || query_len > block.query_len || ref_len > block.ref_len || block_size > block.block_size) {
+        if (block.handle) block_free(block.handle);
+        block.query_len = std::max(query_len, block.query_len);
+        block.ref_len = std::max(ref_len, block.ref_len);
+        block.block_size = std::max(block_size, block.block_size);
+        block.handle = block_new(block.query_len, block.ref_len, block.block_size);
+    }
+    return block.handle;
+}
+
+BlockHandle BlockAlignerWorkspace::global_block(size_t query_len, size_t ref_len, size_t block_size) {
+    return grow(global_, query_len, ref_len, block_size, block_new_aa, block_free_aa);
+}
+
+BlockHandle BlockAlignerWorkspace::xdrop_block(size_t query_len, size_t ref_len, size_t block_size) {
+    return grow(xdrop_, query_len, ref_len, block_size, block_new_aa_xdrop, block_free_aa_xdrop);
+}
+
+BlockHandle BlockAlignerWorkspace::global_trace_block(size_t query_len, size_t ref_len, size_t block_size) {
+    return grow(global_trace_, query_len, ref_len, block_size, block_new_aa_trace, block_free_aa_trace);
+}
+
+BlockHandle BlockAlignerWorkspace::xdrop_trace_block(size_t query_len, size_t ref_len, size_t block_size) {
+    return grow(xdrop_trace_, query_len, ref_len, block_size, block_new_aa_trace_xdrop, block_free_aa_trace_xdrop);
+}
+
+Cigar* BlockAlignerWorkspace::cigar(size_t query_len, size_t ref_len) {
+    if (!cigar_ || query_len > cigar_query_len_ || ref_len > cigar_ref_len_) {
+        if (cigar_) block_free_cigar(cigar_);
+        cigar_query_len_ = std::max(query_len, cigar_query_len_);
+        cigar_ref_len_ = std::max(ref_len, cigar_ref_len_);
+        cigar_ = block_new_cigar(cigar_query_len_, cigar_ref_len_);
+    }
+    return cigar_;
+}
+
+namespace {
+
+constexpr int16_t kLaneNegInf = -16384;
+
+// Trace byte per cell and lane: bits 0-1 hold where H came from, bit 2 is set
+// when the D gap was extended and bit 3 when the I gap was extended.
+constexpr uint8_t kFromDiag = 0;
+constexpr uint8_t kFromD = 1;
+constexpr uint8_t kFromI = 2;
+constexpr uint8_t kExtendD = 4;
+constexpr uint8_t kExtendI = 8;
+
+uintptr_t next_power_of_two(size_t n) {
+    uintptr_t size = 1;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+template <typename Scoring>
+int16_t gap_score(size_t len, const Scoring& scoring_params) {
+    return scoring_params.gap_open + (int16_t)(len - 1) * scoring_params.gap_extend;
+}
+
+// Appends to the CIGAR that starts at ops[begin], merging with its last op.
+void push_op(std::vector<OpLen>& ops, size_t begin, Operation op, uintptr_t len) {
+    if (ops.size() > begin && ops.back().op == op) {
+        ops.back().len += len;
+    } else {
+        ops.push_back({op, len});
+    }
+}
+
+}
+
+namespace {
+
+// Plain Gotoh DP on the stack for pairs of at most kSmallGapMaxLength bases per
+// side. For these sizes the setup of the block aligner (padding, FFI calls,
+// block sizes of 32+) costs far more than the handful of cells being filled.
+template <typename Scoring>
+int small_gap_kernel(std::string_view query, std::string_view ref, const Scoring& scoring_params, std::vector<OpLen>& cigar) {
+    constexpr size_t N = kSmallGapMaxLength + 1;
+    const size_t rows = query.length();
+    const size_t cols = ref.length();
+    const int open = scoring_params.gap_open;
+    const int extend = scoring_params.gap_extend;
+
+    int h[N];
+    int f[N];
+    uint8_t trace[N][N];
+
+    h[0] = 0;
+    f[0] = kLaneNegInf;
+    trace[0][0] = kFromDiag;
+    for (size_t j = 1; j <= cols; j++) {
+        h[j] = gap_score(j, scoring_params);
+        f[j] = kLaneNegInf;
+        trace[0][j] = kFromD | (j > 1 ? kExtendD : 0);
+    }
+    for (size_t i = 1; i <= rows; i++) {
+        int diag = h[0];
+        h[0] = gap_score(i, scoring_params);
+        f[0] = h[0];
+        trace[i][0] = kFromI | (i > 1 ? kExtendI : 0);
+        int e = kLaneNegInf;
+        for (size_t j = 1; j <= cols; j++) {
+            int e_open = h[j - 1] + open;
+            int e_ext = e + extend;
+            int f_open = h[j] + open;
+            int f_ext = f[j] + extend;
+            e = std::max(e_open, e_ext);
+            f[j] = std::max(f_open, f_ext);
+            int d = diag + (query[i - 1] == ref[j - 1] ? scoring_params.match : scoring_params.mismatch);
+            int best = std::max(d, std::max(e, f[j]));
+            trace[i][j] = (d == best ? kFromDiag : (e == best ? kFromD : kFromI)) | (e_ext > e_open ? kExtendD : 0) | (f_ext > f_open ? kExtendI : 0);
+            diag = h[j];
+            h[j] = best;
+        }
+    }
+
+    Operation ops[2 * N];
+    size_t op_count = 0;
+    size_t i = rows;
+    size_t j = cols;
+    uint8_t state = 0;
+    while (i > 0 || j > 0) {
+        uint8_t cell = trace[i][j];
+        if (state == 0) {
+            state = cell & 3;
+            if (state == kFromDiag) {
+                ops[op_count++] = query[i - 1] == ref[j - 1] ? Operation::Eq : Operation::X;
+                i--;
+                j--;
+            }
+        } else if (state == kFromD) {
+            ops[op_count++] = Operation::D;
+            state = (cell & kExtendD) ? kFromD : 0;
+            j--;
+        } else {
+            ops[op_count++] = Operation::I;
+            state = (cell & kExtendI) ? kFromI : 0;
+            i--;
+        }
+    }
+    size_t begin = cigar.size();
+    while (op_count > 0) {
+        push_op(cigar, begin, ops[--op_count], 1);
+    }
+    return h[cols];
+}
+
+}
+
+int small_gap_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, std::vector<OpLen>& cigar) {
+    return dispatch_scoring(scoring_params, [&](const auto& scoring) {
+        return small_gap_kernel(query, ref, scoring, cigar);
+    });
+}
+
+template <typename Preset>
+int small_gap_alignment(std::string_view query, std::string_view ref, const Preset& scoring_params, std::vector<OpLen>& cigar) {
+    return small_gap_kernel(query, ref, scoring_params, cigar);
+}
+
+template int small_gap_alignment(std::string_view, std::string_view, const DefaultScoring&, std::vector<OpLen>&);
+
+size_t estimated_trace_bytes(size_t query_len, size_t ref_len, size_t block_size) {
+    return (query_len + ref_len) * block_size / 2;
+}
+
+namespace {
+
+// Column range of row i in the band of checkpointed_global_alignment.
+struct DiagonalBand {
+    size_t rows;
+    size_t cols;
+    size_t half_width;
+
+    size_t center(size_t i) const { return i * cols / rows; }
+    size_t lo(size_t i) const { return center(i) > half_width ? center(i) - half_width : 0; }
+    size_t hi(size_t i) const { return std::min(cols, center(i) + half_width); }
 };
 
-AlignmentResult run_block_alignment(const std::string& query, const std::string& ref, AlignmentMode mode, const AlignmentScoring& scoring_params) {
+constexpr int kBandNegInf = -(1 << 29);
+
+// Computes rows [first, last] of the banded Gotoh matrix in place over h and f,
+// which hold row first - 1 on entry. Trace bytes go to trace[(i - first) * width
+// + j - lo(i)] when trace is not null.
+void banded_gotoh_rows(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, const DiagonalBand& band,
+                       size_t first, size_t last, int* h, int* f, uint8_t* trace, size_t width) {
+    const int open = scoring_params.gap_open;
+    const int extend = scoring_params.gap_extend;
+    for (size_t i = first; i <= last; i++) {
+        const size_t lo = band.lo(i);
+        const size_t hi = band.hi(i);
+        uint8_t* trace_row = trace ? trace + (i - first) * width : nullptr;
+        int diag;
+        int h_left;
+        size_t j = lo;
+        if (lo == 0) {
+            diag = h[0];
+            h[0] = open + static_cast<int>(i - 1) * extend;
+            f[0] = h[0];
+            h_left = h[0];
+            if (trace_row) trace_row[0] = kFromI | (i > 1 ? kExtendI : 0);
+            j = 1;
+        } else {
+            diag = h[lo - 1];
+            h_left = kBandNegInf;
+        }
+        int e = kBandNegInf;
+        for (; j <= hi; j++) {
+            int e_open = h_left + open;
+            int e_ext = e + extend;
+            int f_open = h[j] + open;
+            int f_ext = f[j] + extend;
+            e = std::max(e_open, e_ext);
+            f[j] = std::max(f_open, f_ext);
+            int d = diag + (query[i - 1] == ref[j - 1] ? scoring_params.match : scoring_params.mismatch);
+            int best = std::max(d, std::max(e, f[j]));
+            if (trace_row) {
+                trace_row[j - lo] = (d == best ? kFromDiag : (e == best ? kFromD : kFromI)) | (e_ext > e_open ? kExtendD : 0) | (f_ext > f_open ? kExtendI : 0);
+            }
+            diag = h[j];
+            h[j] = best;
+            h_left = best;
+        }
+        // The cell left of the band is outside of it for the next row too.
+        if (lo > 0) {
+            h[lo - 1] = kBandNegInf;
+            f[lo - 1] = kBandNegInf;
+        }
+    }
+}
+
+// One checkpointed pass over `band`. Fills `ops` with the path, last
+// operation first, and sets `on_edge` when the path runs along a side of the
+// band that does not lie on the matrix border, where a wider band may score
+// better.
+int banded_checkpointed_pass(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, const DiagonalBand& band,
+                             std::vector<Operation>& ops, bool& on_edge) {
+    const size_t rows = query.length();
+    const size_t cols = ref.length();
+    const size_t width = 2 * band.half_width + 1;
+    const size_t interval = std::max<size_t>(1, static_cast<size_t>(std::sqrt(static_cast<double>(rows))));
+
+    std::vector<int> h(cols + 1, kBandNegInf);
+    std::vector<int> f(cols + 1, kBandNegInf);
+    h[0] = 0;
+    for (size_t j = 1; j <= band.hi(0); j++) {
+        h[j] = scoring_params.gap_open + static_cast<int>(j - 1) * scoring_params.gap_extend;
+    }
+
+    // Rows 0, interval, 2 * interval, ... of h and f, band cells only.
+    std::vector<int> checkpoints;
+    checkpoints.reserve((rows / interval + 1) * 2 * width);
+    auto save_checkpoint = [&](size_t i) {
+        checkpoints.insert(checkpoints.end(), h.begin() + band.lo(i), h.begin() + band.hi(i) + 1);
+        checkpoints.insert(checkpoints.end(), f.begin() + band.lo(i), f.begin() + band.hi(i) + 1);
+    };
+    std::vector<size_t> checkpoint_offsets;
+    for (size_t i = 0; i < rows; i += interval) {
+        if (i > 0) banded_gotoh_rows(query, ref, scoring_params, band, i - interval + 1, i, h.data(), f.data(), nullptr, 0);
+        checkpoint_offsets.push_back(checkpoints.size());
+        save_checkpoint(i);
+    }
+    const size_t last_checkpoint = (checkpoint_offsets.size() - 1) * interval;
+    banded_gotoh_rows(query, ref, scoring_params, band, last_checkpoint + 1, rows, h.data(), f.data(), nullptr, 0);
+    const int score = h[cols];
+
+    std::vector<uint8_t> trace(interval * width);
+    size_t stripe_first = rows + 1;
+    auto load_stripe = [&](size_t i) {
+        const size_t c = (i - 1) / interval;
+        const size_t start = c * interval;
+        const size_t last = std::min(rows, start + interval);
+        const size_t lo = band.lo(start);
+        const size_t count = band.hi(start) - lo + 1;
+        const int* saved = checkpoints.data() + checkpoint_offsets[c];
+        std::copy(saved, saved + count, h.begin() + lo);
+        std::copy(saved + count, saved + 2 * count, f.begin() + lo);
+        if (lo > 0) {
+            h[lo - 1] = kBandNegInf;
+            f[lo - 1] = kBandNegInf;
+        }
+        std::fill(h.begin() + band.hi(start) + 1, h.begin() + band.hi(last) + 1, kBandNegInf);
+        std::fill(f.begin() + band.hi(start) + 1, f.begin() + band.hi(last) + 1, kBandNegInf);
+        banded_gotoh_rows(query, ref, scoring_params, band, start + 1, last, h.data(), f.data(), trace.data(), width);
+        stripe_first = start + 1;
+    };
+
+    ops.clear();
+    on_edge = false;
+    size_t i = rows;
+    size_t j = cols;
+    uint8_t state = 0;
+    while (i > 0 || j > 0) {
+        uint8_t cell;
+        if (i == 0) {
+            cell = kFromD | (j > 1 ? kExtendD : 0);
+        } else {
+            if (i < stripe_first) load_stripe(i);
+            cell = trace[(i - stripe_first) * width + j - band.lo(i)];
+            on_edge = on_edge || (j == band.lo(i) && j > 0) || (j == band.hi(i) && j < cols);
+        }
+        if (state == 0) {
+            state = cell & 3;
+            if (state == kFromDiag) {
+                ops.push_back(query[i - 1] == ref[j - 1] ? Operation::Eq : Operation::X);
+                i--;
+                j--;
+            }
+        } else if (state == kFromD) {
+            ops.push_back(Operation::D);
+            state = (cell & kExtendD) ? kFromD : 0;
+            j--;
+        } else {
+            ops.push_back(Operation::I);
+            state = (cell & kExtendI) ? kFromI : 0;
+            i--;
+        }
+    }
+    return score;
+}
+
+}
+
+int checkpointed_global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, size_t band_width, std::vector<OpLen>& cigar,
+                                  int min_score) {
+    const size_t rows = query.length();
+    const size_t cols = ref.length();
+    const size_t begin = cigar.size();
+    if (rows == 0 || cols == 0) {
+        if (rows > 0) push_op(cigar, begin, Operation::I, rows);
+        if (cols > 0) push_op(cigar, begin, Operation::D, cols);
+        size_t len = rows + cols;
+        return len == 0 ? 0 : scoring_params.gap_open + static_cast<int>(len - 1) * scoring_params.gap_extend;
+    }
+
+    // The corner-to-corner diagonal is up to |rows - cols| columns away from
+    // a path that takes the whole length difference as one indel at either
+    // end, so the band starts that much wider than `band_width` (and at least
+    // wide enough for consecutive rows to overlap). While the best path runs
+    // along an inner side of the band or scores below min_score, the band is
+    // doubled and the pass repeated, until it covers the whole matrix.
+    const size_t length_diff = std::max(rows, cols) - std::min(rows, cols);
+    DiagonalBand band = {rows, cols, std::max(band_width + length_diff, cols / rows + 1)};
+    std::vector<Operation> ops;
+    bool on_edge = false;
+    int score = banded_checkpointed_pass(query, ref, scoring_params, band, ops, on_edge);
+    while ((on_edge || score < min_score) && band.half_width < cols) {
+        band.half_width = std::min(cols, 2 * band.half_width);
+        score = banded_checkpointed_pass(query, ref, scoring_params, band, ops, on_edge);
+    }
+    for (auto it = ops.rbegin(); it != ops.rend(); ++it) {
+        push_op(cigar, begin, *it, 1);
+    }
+    return score;
+}
+
+BlockSettings block_settings(const AlignmentPolicy& policy, AlignmentMode mode, size_t query_len, size_t ref_len, const AlignmentScoring& scoring_params) {
+    const size_t longest = std::max(query_len, ref_len);
+    const size_t length_diff = std::max(query_len, ref_len) - std::min(query_len, ref_len);
+    const size_t expected_errors = static_cast<size_t>(std::ceil(policy.error_rate * longest));
+
+    BlockSettings settings;
+    settings.range.max = std::clamp(next_power_of_two(longest), policy.min_block_size, policy.max_block_size);
+    settings.range.min = std::clamp(next_power_of_two(length_diff + expected_errors), policy.min_block_size, settings.range.max);
+
+    if (mode == AlignmentMode::Global) {
+        settings.x_drop = 0;
+    } else if (policy.x_drop >= 0) {
+        settings.x_drop = policy.x_drop;
+    } else {
+        const size_t window = std::min<size_t>(longest, settings.range.max);
+        const int32_t window_errors = std::max<int32_t>(1, static_cast<int32_t>(std::ceil(policy.error_rate * window)));
+        settings.x_drop = window_errors * (scoring_params.match - scoring_params.mismatch) - scoring_params.gap_open;
+    }
+    return settings;
+}
+
+template <AlignmentMode Mode>
+AlignmentResult run_block_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, bool traceback, CigarBuilder* cigar_out = nullptr) {
     AlignmentResult result;
 
     if (query.length() == 0 || ref.length() == 0) {
@@ -73,82 +610,544 @@ AlignmentResult run_block_alignment(const std::string& query, const std::string&
         return result;
     }
 
-    std::string processed_query = query;
-    std::string processed_ref = ref;
     size_t original_query_len = query.length();
     size_t original_ref_len = ref.length();
+    PIECEWISE_STAT_SCOPE(static_cast<AlignmentStage>(static_cast<int>(AlignmentStage::BlockGlobal) + static_cast<int>(Mode)),
+                         uint64_t(original_query_len) * original_ref_len);
+
+    const BlockSettings settings = block_settings(workspace.policy(), Mode, original_query_len, original_ref_len, scoring_params);
+    const SizeRange range = settings.range;
+    const int32_t x_drop_threshold = settings.x_drop;
 
-    if (mode == AlignmentMode::FreeQueryStart) {
-        processed_query = reverse_string(query);
-        processed_ref = reverse_string(ref);
+    // Over the trace budget, the end cell and a score to reach come from a
+    // score-only pass, and the path from a checkpointed global alignment of
+    // the aligned sub-rectangle, whose band widens until it scores at least
+    // as well as the block aligner did.
+    const size_t trace_budget = workspace.policy().trace_budget;
+    if (traceback && trace_budget > 0 && estimated_trace_bytes(original_query_len, original_ref_len, range.max) > trace_budget) {
+        result = run_block_alignment<Mode>(query, ref, scoring_params, workspace, false);
+        result.traceback_pending = false;
+        if constexpr (Mode == AlignmentMode::Global) {
+            result.query_end = original_query_len;
+            result.ref_end = original_ref_len;
+        }
+        if (result.query_end > result.query_start || result.ref_end > result.ref_start) {
+            result.score = checkpointed_global_alignment(query.substr(result.query_start, result.query_end - result.query_start),
+                                                         ref.substr(result.ref_start, result.ref_end - result.ref_start),
+                                                         scoring_params, range.max, result.cigar, result.score);
+        }
+        if (cigar_out) {
+            cigar_out->append(result.cigar.data(), result.cigar.data() + result.cigar.size());
+            result.cigar.clear();
+        }
+        return result;
     }
 
-    SizeRange range = {.min = 32, .max = 256};
     Gaps gaps = {.open = scoring_params.gap_open, .extend = scoring_params.gap_extend};
-    AAMatrix* dna_matrix = block_new_simple_aamatrix(scoring_params.match, scoring_params.mismatch);
+    const AAMatrix* dna_matrix = workspace.matrix(scoring_params);
 
-    PaddedBytes* q_padded = block_new_padded_aa(processed_query.length(), range.max);
-    PaddedBytes* r_padded = block_new_padded_aa(processed_ref.length(), range.max);
+    PaddedBytes* q_padded = workspace.query_padded(original_query_len, range.max);
 
-    block_set_bytes_padded_aa(q_padded, (const uint8_t*)processed_query.c_str(), processed_query.length(), range.max);
-    block_set_bytes_padded_aa(r_padded, (const uint8_t*)processed_ref.c_str(), processed_ref.length(), range.max);
+    // With a reference cache, the padded reference and its profile come ready
+    // made and the reference side is scored through the profile.
+    std::shared_ptr<const ReferenceWindowCache::Window> window;
+    if (ReferenceWindowCache* cache = workspace.policy().reference_cache) {
+        window = cache->get(ref, workspace.reference_origin(ref), range.max, Mode == AlignmentMode::FreeQueryStart, scoring_params);
+    }
+    const AAProfile* profile = window ? window->profile() : nullptr;
+    const PaddedBytes* r_padded = window ? window->padded() : nullptr;
+
+    // FreeQueryStart aligns both sequences backwards from their ends, so they are
+    // reversed while being written into the padded buffers instead of beforehand.
+    if constexpr (Mode == AlignmentMode::FreeQueryStart) {
+        block_set_bytes_rev_padded_aa(q_padded, (const uint8_t*)query.data(), original_query_len, range.max);
+    } else {
+        block_set_bytes_padded_aa(q_padded, (const uint8_t*)query.data(), original_query_len, range.max);
+    }
+    if (!window) {
+        PaddedBytes* padded = workspace.ref_padded(original_ref_len, range.max);
+        if constexpr (Mode == AlignmentMode::FreeQueryStart) {
+            block_set_bytes_rev_padded_aa(padded, (const uint8_t*)ref.data(), original_ref_len, range.max);
+        } else {
+            block_set_bytes_padded_aa(padded, (const uint8_t*)ref.data(), original_ref_len, range.max);
+        }
+        r_padded = padded;
+    }
 
     BlockHandle block = nullptr;
     AlignResult res;
     Cigar* cigar_ptr = nullptr;
 
-    const int32_t x_drop_threshold = 0; // ????
-
-    if (mode == AlignmentMode::Global) {
-        block = block_new_aa_trace(original_query_len, original_ref_len, range.max);
-        block_align_aa_trace(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+    if (!traceback) {
+        if constexpr (Mode == AlignmentMode::Global) {
+            block = workspace.global_block(original_query_len, original_ref_len, range.max);
+            if (profile) {
+                block_align_profile_aa(block, q_padded, profile, range, x_drop_threshold);
+            } else {
+                block_align_aa(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+            }
+            res = block_res_aa(block);
+        } else {
+            block = workspace.xdrop_block(original_query_len, original_ref_len, range.max);
+            if (profile) {
+                block_align_profile_aa_xdrop(block, q_padded, profile, range, x_drop_threshold);
+            } else {
+                block_align_aa_xdrop(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+            }
+            res = block_res_aa_xdrop(block);
+        }
+    } else if constexpr (Mode == AlignmentMode::Global) {
+        block = workspace.global_trace_block(original_query_len, original_ref_len, range.max);
+        if (profile) {
+            block_align_profile_aa_trace(block, q_padded, profile, range, x_drop_threshold);
+        } else {
+            block_align_aa_trace(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+        }
         res = block_res_aa_trace(block);
-        cigar_ptr = block_new_cigar(res.query_idx, res.reference_idx);
+        cigar_ptr = workspace.cigar(res.query_idx, res.reference_idx);
         block_cigar_eq_aa_trace(block, q_padded, r_padded, res.query_idx, res.reference_idx, cigar_ptr);
-        block_free_aa_trace(block);
     } else {
-        block = block_new_aa_trace_xdrop(processed_query.length(), processed_ref.length(), range.max);
-        block_align_aa_trace_xdrop(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+        block = workspace.xdrop_trace_block(original_query_len, original_ref_len, range.max);
+        if (profile) {
+            block_align_profile_aa_trace_xdrop(block, q_padded, profile, range, x_drop_threshold);
+        } else {
+            block_align_aa_trace_xdrop(block, q_padded, r_padded, dna_matrix, gaps, range, x_drop_threshold);
+        }
         res = block_res_aa_trace_xdrop(block);
-        cigar_ptr = block_new_cigar(res.query_idx, res.reference_idx);
+        cigar_ptr = workspace.cigar(res.query_idx, res.reference_idx);
         block_cigar_eq_aa_trace_xdrop(block, q_padded, r_padded, res.query_idx, res.reference_idx, cigar_ptr);
-        block_free_aa_trace_xdrop(block);
     }
 
     result.score = res.score;
-    size_t cigar_len = block_len_cigar(cigar_ptr);
 
-    if (mode == AlignmentMode::FreeQueryStart) {
+    if constexpr (Mode == AlignmentMode::FreeQueryStart) {
         result.query_start = original_query_len - res.query_idx;
         result.query_end = original_query_len;
         result.ref_start = original_ref_len - res.reference_idx;
         result.ref_end = original_ref_len;
-        result.cigar = reverse_cigar_vector(cigar_ptr, cigar_len);
     } else {
         result.query_start = 0;
         result.query_end = res.query_idx;
         result.ref_start = 0;
         result.ref_end = res.reference_idx;
+    }
+
+    if (!traceback) {
+        result.traceback_pending = true;
+        result.traceback_mode = Mode;
+        result.traceback_query = query;
+        result.traceback_ref = ref;
+        result.traceback_scoring = scoring_params;
+        return result;
+    }
+
+    if (cigar_out) {
+        cigar_out->append(cigar_ptr, Mode == AlignmentMode::FreeQueryStart);
+        return result;
+    }
+
+    size_t cigar_len = block_len_cigar(cigar_ptr);
+    if constexpr (Mode == AlignmentMode::FreeQueryStart) {
+        result.cigar = reverse_cigar_vector(cigar_ptr, cigar_len);
+    } else {
         result.cigar = build_cigar_vector(cigar_ptr, cigar_len);
     }
 
-    block_free_cigar(cigar_ptr);
-    block_free_padded_aa(q_padded);
-    block_free_padded_aa(r_padded);
-    block_free_aamatrix(dna_matrix);
+    return result;
+}
+
+namespace {
+
+// Alignment cache variant of the exact DP kernels, whose results depend only
+// on the sequences and the scoring.
+constexpr uint64_t kExactDpVariant = 0;
+
+// Block-aligner results also depend on the block settings and on whether the
+// traceback goes through checkpointed_global_alignment, so those are part of
+// the key.
+template <AlignmentMode Mode>
+uint64_t block_memo_variant(const BlockSettings& settings, bool checkpointed) {
+    return (uint64_t(Mode) + 1) | uint64_t(settings.range.min & 0xffff) << 2 | uint64_t(settings.range.max & 0xffff) << 18 |
+           uint64_t(uint32_t(settings.x_drop) & 0x1fffffff) << 34 | uint64_t(checkpointed) << 63;
+}
+
+// run_block_alignment with a traceback, through the policy's alignment cache
+// when there is one and both sequences are short enough.
+template <AlignmentMode Mode>
+AlignmentResult memoized_block_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, CigarBuilder* cigar_out = nullptr) {
+    GapAlignmentCache* memo = workspace.policy().alignment_cache;
+    if (!memo || query.empty() || ref.empty() || query.length() > kAlignmentMemoMaxLength || ref.length() > kAlignmentMemoMaxLength) {
+        return run_block_alignment<Mode>(query, ref, scoring_params, workspace, true, cigar_out);
+    }
+
+    const BlockSettings settings = block_settings(workspace.policy(), Mode, query.length(), ref.length(), scoring_params);
+    const size_t trace_budget = workspace.policy().trace_budget;
+    const bool checkpointed = trace_budget > 0 && estimated_trace_bytes(query.length(), ref.length(), settings.range.max) > trace_budget;
+    const uint64_t variant = block_memo_variant<Mode>(settings, checkpointed);
 
+    AlignmentResult result;
+    GapAlignmentCache::Span span;
+    if (memo->find(query, ref, scoring_params, variant, span, result.cigar)) {
+        result.score = span.score;
+        result.query_start = span.query_start;
+        result.query_end = span.query_end;
+        result.ref_start = span.ref_start;
+        result.ref_end = span.ref_end;
+    } else {
+        result = run_block_alignment<Mode>(query, ref, scoring_params, workspace, true);
+        span = {result.score, uint32_t(result.query_start), uint32_t(result.query_end), uint32_t(result.ref_start), uint32_t(result.ref_end)};
+        memo->insert(query, ref, scoring_params, variant, span, result.cigar.data(), result.cigar.data() + result.cigar.size());
+    }
+    if (cigar_out) {
+        cigar_out->append(result.cigar.data(), result.cigar.data() + result.cigar.size());
+        result.cigar.clear();
+    }
     return result;
 }
 
-AlignmentResult global_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params) {
-    return run_block_alignment(query, ref, AlignmentMode::Global, scoring_params);
 }
 
-AlignmentResult free_query_end_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params) {
-    return run_block_alignment(query, ref, AlignmentMode::FreeQueryEnd, scoring_params);
+template <AlignmentMode Mode, typename Scoring>
+AlignmentResult pairwise_alignment(std::string_view query, std::string_view ref, const Scoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    if constexpr (Mode == AlignmentMode::Global) {
+        if (!query.empty() && !ref.empty() && query.length() <= kSmallGapMaxLength && ref.length() <= kSmallGapMaxLength) {
+            AlignmentResult result;
+            result.score = small_gap_kernel(query, ref, scoring_params, result.cigar);
+            result.query_start = 0;
+            result.query_end = query.length();
+            result.ref_start = 0;
+            result.ref_end = ref.length();
+            return result;
+        }
+    }
+    return memoized_block_alignment<Mode>(query, ref, scoring_params, workspace);
+}
+
+template AlignmentResult pairwise_alignment<AlignmentMode::Global>(std::string_view, std::string_view, const AlignmentScoring&, BlockAlignerWorkspace&);
+template AlignmentResult pairwise_alignment<AlignmentMode::FreeQueryEnd>(std::string_view, std::string_view, const AlignmentScoring&, BlockAlignerWorkspace&);
+template AlignmentResult pairwise_alignment<AlignmentMode::FreeQueryStart>(std::string_view, std::string_view, const AlignmentScoring&, BlockAlignerWorkspace&);
+template AlignmentResult pairwise_alignment<AlignmentMode::Global>(std::string_view, std::string_view, const DefaultScoring&, BlockAlignerWorkspace&);
+template AlignmentResult pairwise_alignment<AlignmentMode::FreeQueryEnd>(std::string_view, std::string_view, const DefaultScoring&, BlockAlignerWorkspace&);
+template AlignmentResult pairwise_alignment<AlignmentMode::FreeQueryStart>(std::string_view, std::string_view, const DefaultScoring&, BlockAlignerWorkspace&);
+
+AlignmentResult global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return dispatch_scoring(scoring_params, [&](const auto& scoring) {
+        return pairwise_alignment<AlignmentMode::Global>(query, ref, scoring, workspace);
+    });
+}
+
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return pairwise_alignment<AlignmentMode::FreeQueryEnd>(query, ref, scoring_params, workspace);
+}
+
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return pairwise_alignment<AlignmentMode::FreeQueryStart>(query, ref, scoring_params, workspace);
 }
 
-AlignmentResult free_query_start_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params) {
-    return run_block_alignment(query, ref, AlignmentMode::FreeQueryStart, scoring_params);
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, CigarBuilder& cigar) {
+    return memoized_block_alignment<AlignmentMode::FreeQueryEnd>(query, ref, scoring_params, workspace, &cigar);
 }
 
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, CigarBuilder& cigar) {
+    return memoized_block_alignment<AlignmentMode::FreeQueryStart>(query, ref, scoring_params, workspace, &cigar);
+}
+
+AlignmentResult global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return global_alignment(query, ref, scoring_params, workspace);
+}
+
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return free_query_end_alignment(query, ref, scoring_params, workspace);
+}
+
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return free_query_start_alignment(query, ref, scoring_params, workspace);
+}
+
+
+AlignmentResult global_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return run_block_alignment<AlignmentMode::Global>(query, ref, scoring_params, workspace, false);
+}
+
+AlignmentResult free_query_end_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return run_block_alignment<AlignmentMode::FreeQueryEnd>(query, ref, scoring_params, workspace, false);
+}
+
+AlignmentResult free_query_start_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace) {
+    return run_block_alignment<AlignmentMode::FreeQueryStart>(query, ref, scoring_params, workspace, false);
+}
+
+AlignmentResult global_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return global_alignment_score(query, ref, scoring_params, workspace);
+}
+
+AlignmentResult free_query_end_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return free_query_end_alignment_score(query, ref, scoring_params, workspace);
+}
+
+AlignmentResult free_query_start_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params) {
+    BlockAlignerWorkspace workspace;
+    return free_query_start_alignment_score(query, ref, scoring_params, workspace);
+}
+
+// The traceback runs the same block alignment as the score-only pass, so it
+// ends in the same cell with the same score.
+void AlignmentResult::compute_cigar(BlockAlignerWorkspace& workspace) {
+    if (!traceback_pending) {
+        return;
+    }
+    AlignmentResult traced;
+    switch (traceback_mode) {
+        case AlignmentMode::Global:
+            traced = run_block_alignment<AlignmentMode::Global>(traceback_query, traceback_ref, traceback_scoring, workspace, true);
+            break;
+        case AlignmentMode::FreeQueryEnd:
+            traced = run_block_alignment<AlignmentMode::FreeQueryEnd>(traceback_query, traceback_ref, traceback_scoring, workspace, true);
+            break;
+        case AlignmentMode::FreeQueryStart:
+            traced = run_block_alignment<AlignmentMode::FreeQueryStart>(traceback_query, traceback_ref, traceback_scoring, workspace, true);
+            break;
+    }
+    score = traced.score;
+    query_start = traced.query_start;
+    query_end = traced.query_end;
+    ref_start = traced.ref_start;
+    ref_end = traced.ref_end;
+    cigar = std::move(traced.cigar);
+    traceback_pending = false;
+}
+
+void AlignmentResult::compute_cigar() {
+    BlockAlignerWorkspace workspace;
+    compute_cigar(workspace);
+}
+
+void BatchAlignmentResult::clear() {
+    scores.clear();
+    cigar_offsets.clear();
+    cigar_ops.clear();
+}
+
+namespace {
+
+// Gotoh DP over up to kBatchLanes pairs at once. Every lane walks the same
+// (rows x cols) grid, padded past its own lengths; the inner loop over lanes has
+// no cross-lane dependency so the compiler maps it onto SIMD registers.
+template <typename Scoring>
+void align_lane_group(const GapPair* pairs, const size_t* group, size_t lanes, const Scoring& scoring_params,
+                      BlockAlignerWorkspace::BatchScratch& scratch, int* scores, size_t* op_ranges) {
+    constexpr size_t L = kBatchLanes;
+    size_t rows = 0;
+    size_t cols = 0;
+    for (size_t l = 0; l < lanes; l++) {
+        rows = std::max(rows, pairs[group[l]].query.length());
+        cols = std::max(cols, pairs[group[l]].ref.length());
+    }
+
+    scratch.query_lanes.assign((rows + 1) * L, 0);
+    scratch.ref_lanes.assign((cols + 1) * L, 0xff);
+    for (size_t l = 0; l < lanes; l++) {
+        const GapPair& pair = pairs[group[l]];
+        for (size_t i = 0; i < pair.query.length(); i++) scratch.query_lanes[(i + 1) * L + l] = (uint8_t)pair.query[i];
+        for (size_t j = 0; j < pair.ref.length(); j++) scratch.ref_lanes[(j + 1) * L + l] = (uint8_t)pair.ref[j];
+    }
+
+    const int16_t match = scoring_params.match;
+    const int16_t mismatch = scoring_params.mismatch;
+    const int16_t open = scoring_params.gap_open;
+    const int16_t extend = scoring_params.gap_extend;
+
+    scratch.h_row.resize((cols + 1) * L);
+    scratch.f_row.resize((cols + 1) * L);
+    scratch.trace.resize((rows + 1) * (cols + 1) * L);
+    int16_t* h_row = scratch.h_row.data();
+    int16_t* f_row = scratch.f_row.data();
+    uint8_t* trace = scratch.trace.data();
+
+    for (size_t l = 0; l < L; l++) {
+        h_row[l] = 0;
+        f_row[l] = kLaneNegInf;
+        trace[l] = kFromDiag;
+    }
+    for (size_t j = 1; j <= cols; j++) {
+        for (size_t l = 0; l < L; l++) {
+            h_row[j * L + l] = gap_score(j, scoring_params);
+            f_row[j * L + l] = kLaneNegInf;
+            trace[j * L + l] = kFromD | (j > 1 ? kExtendD : 0);
+        }
+    }
+
+    alignas(32) int16_t e[L];
+    alignas(32) int16_t diag[L];
+    for (size_t i = 1; i <= rows; i++) {
+        const uint8_t* q = &scratch.query_lanes[i * L];
+        uint8_t* trace_row = trace + i * (cols + 1) * L;
+        for (size_t l = 0; l < L; l++) {
+            diag[l] = h_row[l];
+            h_row[l] = gap_score(i, scoring_params);
+            f_row[l] = h_row[l];
+            e[l] = kLaneNegInf;
+            trace_row[l] = kFromI | (i > 1 ? kExtendI : 0);
+        }
+        for (size_t j = 1; j <= cols; j++) {
+            const uint8_t* r = &scratch.ref_lanes[j * L];
+            int16_t* h = h_row + j * L;
+            int16_t* f = f_row + j * L;
+            const int16_t* h_left = h_row + (j - 1) * L;
+            uint8_t* t = trace_row + j * L;
+            for (size_t l = 0; l < L; l++) {
+                int16_t e_open = h_left[l] + open;
+                int16_t e_ext = e[l] + extend;
+                int16_t f_open = h[l] + open;
+                int16_t f_ext = f[l] + extend;
+                int16_t e_new = std::max(e_open, e_ext);
+                int16_t f_new = std::max(f_open, f_ext);
+                int16_t d = diag[l] + (q[l] == r[l] ? match : mismatch);
+                int16_t best = std::max(d, std::max(e_new, f_new));
+                uint8_t from = d == best ? kFromDiag : (e_new == best ? kFromD : kFromI);
+                t[l] = from | (e_ext > e_open ? kExtendD : 0) | (f_ext > f_open ? kExtendI : 0);
+                diag[l] = h[l];
+                e[l] = e_new;
+                f[l] = f_new;
+                h[l] = best;
+            }
+        }
+    }
+
+    // Scores are only valid at each lane's own (query_len, ref_len) cell, which
+    // was overwritten by later rows, so they are re-derived while tracing back.
+    for (size_t l = 0; l < lanes; l++) {
+        const GapPair& pair = pairs[group[l]];
+        std::vector<Operation>& lane_ops = scratch.lane_ops;
+        lane_ops.clear();
+        size_t i = pair.query.length();
+        size_t j = pair.ref.length();
+        int score = 0;
+        uint8_t state = 0;
+        while (i > 0 || j > 0) {
+            uint8_t cell = trace[(i * (cols + 1) + j) * L + l];
+            if (state == 0) {
+                state = cell & 3;
+                if (state == kFromDiag) {
+                    bool eq = pair.query[i - 1] == pair.ref[j - 1];
+                    lane_ops.push_back(eq ? Operation::Eq : Operation::X);
+                    score += eq ? match : mismatch;
+                    i--;
+                    j--;
+                    state = 0;
+                }
+            } else if (state == kFromD) {
+                lane_ops.push_back(Operation::D);
+                score += (cell & kExtendD) ? extend : open;
+                state = (cell & kExtendD) ? kFromD : 0;
+                j--;
+            } else {
+                lane_ops.push_back(Operation::I);
+                score += (cell & kExtendI) ? extend : open;
+                state = (cell & kExtendI) ? kFromI : 0;
+                i--;
+            }
+        }
+        size_t begin = scratch.ops.size();
+        for (auto it = lane_ops.rbegin(); it != lane_ops.rend(); ++it) {
+            push_op(scratch.ops, begin, *it, 1);
+        }
+        scores[group[l]] = score;
+        op_ranges[2 * group[l]] = begin;
+        op_ranges[2 * group[l] + 1] = scratch.ops.size();
+    }
+}
+
+template <typename Scoring>
+void global_alignment_batch_kernel(const GapPair* pairs, size_t count, const Scoring& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out) {
+    BlockAlignerWorkspace::BatchScratch& scratch = workspace.batch_scratch();
+    out.clear();
+    out.scores.resize(count);
+    scratch.ops.clear();
+    scratch.op_ranges.assign(2 * count, 0);
+    scratch.order.clear();
+    GapAlignmentCache* memo = workspace.policy().alignment_cache;
+    const AlignmentScoring scoring = scoring_params;
+    GapAlignmentCache::Span span;
+
+    for (size_t idx = 0; idx < count; idx++) {
+        const GapPair& pair = pairs[idx];
+        size_t begin = scratch.ops.size();
+        if (pair.query.empty() || pair.ref.empty()) {
+            if (pair.query.empty() && pair.ref.empty()) {
+                out.scores[idx] = 0;
+            } else if (pair.query.empty()) {
+                out.scores[idx] = gap_score(pair.ref.length(), scoring_params);
+                push_op(scratch.ops, begin, Operation::D, pair.ref.length());
+            } else {
+                out.scores[idx] = gap_score(pair.query.length(), scoring_params);
+                push_op(scratch.ops, begin, Operation::I, pair.query.length());
+            }
+        } else if (pair.query.length() <= kSmallGapMaxLength && pair.ref.length() <= kSmallGapMaxLength) {
+            out.scores[idx] = small_gap_kernel(pair.query, pair.ref, scoring_params, scratch.ops);
+        } else if (pair.query.length() > kBatchMaxLaneLength || pair.ref.length() > kBatchMaxLaneLength) {
+            AlignmentResult aligned = memoized_block_alignment<AlignmentMode::Global>(pair.query, pair.ref, scoring_params, workspace);
+            out.scores[idx] = aligned.score;
+            scratch.ops.insert(scratch.ops.end(), aligned.cigar.begin(), aligned.cigar.end());
+        } else if (memo && memo->find(pair.query, pair.ref, scoring, kExactDpVariant, span, scratch.ops)) {
+            out.scores[idx] = span.score;
+        } else {
+            scratch.order.push_back(idx);
+            continue;
+        }
+        scratch.op_ranges[2 * idx] = begin;
+        scratch.op_ranges[2 * idx + 1] = scratch.ops.size();
+    }
+
+    // Lanes of a group share the DP grid of its largest member, so grouping
+    // pairs of similar shape keeps the padding work small.
+    std::sort(scratch.order.begin(), scratch.order.end(), [pairs](size_t a, size_t b) {
+        size_t a_rows = pairs[a].query.length(), b_rows = pairs[b].query.length();
+        if (a_rows != b_rows) return a_rows < b_rows;
+        return pairs[a].ref.length() < pairs[b].ref.length();
+    });
+    for (size_t start = 0; start < scratch.order.size(); start += kBatchLanes) {
+        size_t lanes = std::min(kBatchLanes, scratch.order.size() - start);
+        align_lane_group(pairs, scratch.order.data() + start, lanes, scoring_params, scratch, out.scores.data(), scratch.op_ranges.data());
+    }
+    if (memo) {
+        for (size_t idx : scratch.order) {
+            const GapPair& pair = pairs[idx];
+            span = {out.scores[idx], 0, uint32_t(pair.query.length()), 0, uint32_t(pair.ref.length())};
+            memo->insert(pair.query, pair.ref, scoring, kExactDpVariant, span,
+                         scratch.ops.data() + scratch.op_ranges[2 * idx], scratch.ops.data() + scratch.op_ranges[2 * idx + 1]);
+        }
+    }
+
+    out.cigar_offsets.resize(count + 1);
+    out.cigar_offsets[0] = 0;
+    out.cigar_ops.reserve(scratch.ops.size());
+    for (size_t idx = 0; idx < count; idx++) {
+        out.cigar_ops.insert(out.cigar_ops.end(), scratch.ops.begin() + scratch.op_ranges[2 * idx], scratch.ops.begin() + scratch.op_ranges[2 * idx + 1]);
+        out.cigar_offsets[idx + 1] = out.cigar_ops.size();
+    }
+}
+
+}
+
+void global_alignment_batch(const GapPair* pairs, size_t count, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out) {
+    dispatch_scoring(scoring_params, [&](const auto& scoring) {
+        global_alignment_batch_kernel(pairs, count, scoring, workspace, out);
+    });
+}
+
+template <typename Preset>
+void global_alignment_batch(const GapPair* pairs, size_t count, const Preset& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out) {
+    global_alignment_batch_kernel(pairs, count, scoring_params, workspace, out);
+}
+
+template void global_alignment_batch(const GapPair*, size_t, const DefaultScoring&, BlockAlignerWorkspace&, BatchAlignmentResult&);
+
+void global_alignment_batch(const std::vector<GapPair>& pairs, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out) {
+    global_alignment_batch(pairs.data(), pairs.size(), scoring_params, workspace, out);
+}
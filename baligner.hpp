@@ -1,6 +1,9 @@
 #ifndef BLOCK_ALIGNER_WRAPPER_H
 #define BLOCK_ALIGNER_WRAPPER_H
+#include <limits>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstddef>
 #include "block_aligner.h"
@@ -12,6 +15,175 @@ struct AlignmentScoring {
     int8_t gap_extend;
 };
 
+// Scoring fixed at compile time. The kernels read match, mismatch, gap_open and
+// gap_extend by member name, so the same code takes either an AlignmentScoring
+// or a preset, and a preset instantiation folds the scores into constants.
+template <int8_t Match, int8_t Mismatch, int8_t GapOpen, int8_t GapExtend>
+struct ScoringPreset {
+    static constexpr int8_t match = Match;
+    static constexpr int8_t mismatch = Mismatch;
+    static constexpr int8_t gap_open = GapOpen;
+    static constexpr int8_t gap_extend = GapExtend;
+
+    constexpr operator AlignmentScoring() const { return {Match, Mismatch, GapOpen, GapExtend}; }
+    static constexpr bool matches(const AlignmentScoring& scoring_params) {
+        return scoring_params.match == Match && scoring_params.mismatch == Mismatch &&
+               scoring_params.gap_open == GapOpen && scoring_params.gap_extend == GapExtend;
+    }
+};
+
+// Presets with specialized kernels. A new one needs a branch in
+// dispatch_scoring and explicit instantiations in baligner.cpp and piecewise.cpp.
+using DefaultScoring = ScoringPreset<3, -1, -3, -1>;
+
+// Calls `f` with the preset equal to `scoring_params`, or with `scoring_params`
+// itself when no preset matches.
+template <typename F>
+decltype(auto) dispatch_scoring(const AlignmentScoring& scoring_params, F&& f) {
+    if (DefaultScoring::matches(scoring_params)) return f(DefaultScoring{});
+    return f(scoring_params);
+}
+
+enum class AlignmentMode {
+    Global,
+    FreeQueryEnd,
+    FreeQueryStart
+};
+
+// Soft clip: query bases at either end left out of the alignment. The block
+// aligner never produces it; it only appears in CIGARs of local-mode
+// piecewise alignments, outside [query_start, query_end).
+constexpr Operation kSoftClip = static_cast<Operation>(6);
+
+class ReferenceWindowCache;
+class GapAlignmentCache;
+
+// How the block aligner is driven, per alignment. Block sizes must be powers
+// of two. A negative x_drop derives it from error_rate and the scoring; the
+// x-drop only applies to the free-end modes. With soft_clip, the piecewise end
+// extensions give up on a read end once the x-drop fires and the rest of that
+// end is reported as a soft clip.
+struct AlignmentPolicy {
+    double error_rate = 0.1;
+    uintptr_t min_block_size = 32;
+    uintptr_t max_block_size = 256;
+    int32_t x_drop = -1;
+    bool soft_clip = false;
+    // Inner anchor gaps longer than reseed_gap bases are seeded again with
+    // reseed_k-mers before anything is aligned, so only the leftover pieces
+    // reach the DP. 0 disables re-seeding.
+    size_t reseed_gap = 1000;
+    int reseed_k = 11;
+    // Largest block-aligner trace (see estimated_trace_bytes) one traceback may
+    // allocate. Larger alignments go through checkpointed_global_alignment
+    // instead. It searches a band that adapts to the path rather than the
+    // block aligner's blocks and breaks ties its own way, so its score and
+    // CIGAR can differ from a full traceback's. 0 means no limit.
+    size_t trace_budget = size_t(64) << 20;
+    // Shared cache of reference windows and their profiles, or null to build
+    // the padded reference on every alignment. Not owned.
+    ReferenceWindowCache* reference_cache = nullptr;
+    // Shared memo of gap alignments and end extensions of at most
+    // kAlignmentMemoMaxLength bases per side, or null to always align. Not owned.
+    GapAlignmentCache* alignment_cache = nullptr;
+};
+
+constexpr size_t kAlignmentMemoMaxLength = 256;
+
+struct BlockSettings {
+    SizeRange range;
+    int32_t x_drop;
+};
+
+// Block range and x-drop for one alignment. The smallest block covers the
+// length difference plus the indels expected at error_rate, the largest never
+// exceeds the longer sequence, and the x-drop tolerates the errors expected
+// within one largest block, so long unaligned tails are abandoned early.
+BlockSettings block_settings(const AlignmentPolicy& policy, AlignmentMode mode, size_t query_len, size_t ref_len, const AlignmentScoring& scoring_params);
+
+class BlockAlignerWorkspace;
+
+struct GapPair {
+    std::string_view query;
+    std::string_view ref;
+};
+
+// Where a reference view handed to the aligners comes from: `bases` starts at
+// base `offset` of the caller's sequence `sequence` (e.g. a contig index).
+// Lets the reference window cache key a window by position instead of by a
+// hash of its bases.
+struct ReferenceOrigin {
+    std::string_view bases;
+    uint64_t sequence;
+    uint64_t offset;
+};
+
+// Flat output of a batched alignment: the CIGAR of pair i is
+// cigar_ops[cigar_offsets[i], cigar_offsets[i + 1]).
+struct BatchAlignmentResult {
+    std::vector<int> scores;
+    std::vector<size_t> cigar_offsets;
+    std::vector<OpLen> cigar_ops;
+
+    size_t size() const { return scores.size(); }
+    const OpLen* cigar_begin(size_t i) const { return cigar_ops.data() + cigar_offsets[i]; }
+    const OpLen* cigar_end(size_t i) const { return cigar_ops.data() + cigar_offsets[i + 1]; }
+    void clear();
+};
+
+// Append-only CIGAR that merges each op into the previous one when they are
+// the same, so pieces of an alignment can be concatenated without a separate
+// merge pass. Storage comes from a std::pmr resource: pass an arena (e.g. a
+// std::pmr::monotonic_buffer_resource) to keep a batch off the global heap.
+class CigarBuilder {
+public:
+    explicit CigarBuilder(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : resource_(resource) {}
+    ~CigarBuilder();
+    CigarBuilder(CigarBuilder&& other) noexcept;
+    CigarBuilder& operator=(CigarBuilder&& other) noexcept;
+    CigarBuilder(const CigarBuilder&) = delete;
+    CigarBuilder& operator=(const CigarBuilder&) = delete;
+
+    // Position to come back to if what is appended next is discarded.
+    struct Checkpoint {
+        size_t size;
+        uintptr_t last_len;
+    };
+
+    void push(Operation op, uintptr_t len) {
+        if (len == 0) return;
+        if (end_ != ops_ && end_[-1].op == op) {
+            end_[-1].len += len;
+            return;
+        }
+        if (end_ == capacity_end_) reserve(size() + 1);
+        *end_++ = {op, len};
+    }
+    void append(const OpLen* begin, const OpLen* end);
+    // Copies a block-aligner CIGAR straight out of Rust memory, optionally in
+    // reverse order.
+    void append(const Cigar* cigar, bool reversed);
+    void reserve(size_t capacity);
+
+    Checkpoint checkpoint() const { return {size(), empty() ? 0 : end_[-1].len}; }
+    void rollback(const Checkpoint& checkpoint);
+    void clear() { end_ = ops_; }
+
+    const OpLen* begin() const { return ops_; }
+    const OpLen* end() const { return end_; }
+    size_t size() const { return end_ - ops_; }
+    bool empty() const { return end_ == ops_; }
+    std::pmr::memory_resource* resource() const { return resource_; }
+
+private:
+    // Pointers rather than counts, so that writing an op's length is not
+    // assumed to alias the builder's own bookkeeping.
+    std::pmr::memory_resource* resource_;
+    OpLen* ops_ = nullptr;
+    OpLen* end_ = nullptr;
+    OpLen* capacity_end_ = nullptr;
+};
+
 struct AlignmentResult {
     int score;
     size_t query_start;
@@ -20,11 +192,211 @@ struct AlignmentResult {
     size_t ref_end;
     std::vector<OpLen> cigar;
     std::string to_cigar_string() const;
+    // Set for a read aligned as its reverse complement (the minus strand). The
+    // coordinates and the CIGAR are then those of the reverse complement.
+    bool reverse_complement = false;
+
+    // Score-only alignments leave the CIGAR empty and remember what was aligned,
+    // so the traceback can be computed later for the alignments that are kept.
+    // The sequences are held as views and must outlive the call to compute_cigar.
+    // compute_cigar repeats the alignment in the same mode with a traceback, so
+    // with a workspace of the same policy the score and coordinates a caller
+    // ranked candidates by stay as they are. Only when the traceback is over
+    // the policy's trace_budget can `score` change: the checkpointed traceback
+    // aligns the aligned sub-rectangle globally and may find a better path
+    // through it than the x-drop pass did.
+    bool traceback_pending = false;
+    AlignmentMode traceback_mode = AlignmentMode::Global;
+    std::string_view traceback_query;
+    std::string_view traceback_ref;
+    AlignmentScoring traceback_scoring = {};
+
+    bool has_cigar() const { return !traceback_pending; }
+    void compute_cigar(BlockAlignerWorkspace& workspace);
+    void compute_cigar();
+};
+
+// Owns the block-aligner handles used by one alignment at a time, so that
+// consecutive alignments (e.g. the gaps of one read) reuse the same Rust
+// allocations. Buffers only grow when a longer sequence or a larger block
+// shows up; smaller blocks run in the buffers of larger ones.
+// Not thread-safe: use one workspace per thread.
+class BlockAlignerWorkspace {
+public:
+    BlockAlignerWorkspace() = default;
+    // CIGAR assembly scratch is allocated from `resource`.
+    explicit BlockAlignerWorkspace(std::pmr::memory_resource* resource) : cigar_builder_(resource) {}
+    ~BlockAlignerWorkspace();
+    BlockAlignerWorkspace(BlockAlignerWorkspace&& other) noexcept;
+    BlockAlignerWorkspace& operator=(BlockAlignerWorkspace&& other) noexcept;
+    BlockAlignerWorkspace(const BlockAlignerWorkspace&) = delete;
+    BlockAlignerWorkspace& operator=(const BlockAlignerWorkspace&) = delete;
+
+    const AAMatrix* matrix(const AlignmentScoring& scoring_params);
+    PaddedBytes* query_padded(size_t len, size_t block_size);
+    PaddedBytes* ref_padded(size_t len, size_t block_size);
+    BlockHandle global_block(size_t query_len, size_t ref_len, size_t block_size);
+    BlockHandle xdrop_block(size_t query_len, size_t ref_len, size_t block_size);
+    BlockHandle global_trace_block(size_t query_len, size_t ref_len, size_t block_size);
+    BlockHandle xdrop_trace_block(size_t query_len, size_t ref_len, size_t block_size);
+    Cigar* cigar(size_t query_len, size_t ref_len);
+
+    // Scratch memory of the inter-sequence batch kernel, kept here so that
+    // repeated batches do not reallocate it.
+    struct BatchScratch {
+        std::vector<size_t> order;
+        std::vector<uint8_t> query_lanes;
+        std::vector<uint8_t> ref_lanes;
+        std::vector<int16_t> h_row;
+        std::vector<int16_t> f_row;
+        std::vector<uint8_t> trace;
+        std::vector<OpLen> ops;
+        std::vector<size_t> op_ranges;
+        std::vector<Operation> lane_ops;
+    };
+    BatchScratch& batch_scratch() { return batch_; }
+
+    // Builder the piecewise extension assembles each read's CIGAR in.
+    CigarBuilder& cigar_builder() { return cigar_builder_; }
+
+    const AlignmentPolicy& policy() const { return policy_; }
+    void set_policy(const AlignmentPolicy& policy) { policy_ = policy; }
+
+    // Reference windows unpacked from a PackedSequence before they are copied
+    // into the padded buffers.
+    std::string& unpack_scratch() { return unpack_; }
+
+    // Query bases of reverse-complement reads, complemented as they are sliced
+    // off for a gap or an end extension.
+    std::string& strand_scratch() { return strand_; }
+
+    // Origins of the reference views being aligned, sorted by bases.data().
+    // The piecewise kernels fill them for the reads of one call and clear
+    // them before returning.
+    std::vector<ReferenceOrigin>& reference_origins() { return origins_; }
+    // Origin whose bases contain `ref`, or null.
+    const ReferenceOrigin* reference_origin(std::string_view ref) const;
+
+private:
+    struct PaddedBuffer {
+        PaddedBytes* bytes = nullptr;
+        size_t len = 0;
+        size_t block_size = 0;
+    };
+    struct AlignerBlock {
+        BlockHandle handle = nullptr;
+        size_t query_len = 0;
+        size_t ref_len = 0;
+        size_t block_size = 0;
+    };
+    using BlockNew = BlockHandle (*)(uintptr_t, uintptr_t, uintptr_t);
+    using BlockFree = void (*)(BlockHandle);
+
+    static PaddedBytes* grow(PaddedBuffer& buffer, size_t len, size_t block_size);
+    static BlockHandle grow(AlignerBlock& block, size_t query_len, size_t ref_len, size_t block_size, BlockNew block_new, BlockFree block_free);
+    void release();
+
+    AlignmentPolicy policy_;
+    AAMatrix* matrix_ = nullptr;
+    int8_t matrix_match_ = 0;
+    int8_t matrix_mismatch_ = 0;
+    PaddedBuffer query_;
+    PaddedBuffer ref_;
+    AlignerBlock global_;
+    AlignerBlock xdrop_;
+    AlignerBlock global_trace_;
+    AlignerBlock xdrop_trace_;
+    Cigar* cigar_ = nullptr;
+    size_t cigar_query_len_ = 0;
+    size_t cigar_ref_len_ = 0;
+    BatchScratch batch_;
+    std::string unpack_;
+    std::string strand_;
+    std::vector<ReferenceOrigin> origins_;
+    CigarBuilder cigar_builder_;
 };
 
-AlignmentResult global_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params);
-AlignmentResult free_query_end_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params);
-AlignmentResult free_query_start_alignment(const std::string& query, const std::string& ref, const AlignmentScoring& scoring_params);
+AlignmentResult global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+
+AlignmentResult global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
+
+// The above with the mode and scoring fixed at compile time. Instantiated for
+// every mode with AlignmentScoring and with each preset; the runtime entry
+// points forward here.
+template <AlignmentMode Mode, typename Scoring>
+AlignmentResult pairwise_alignment(std::string_view query, std::string_view ref, const Scoring& scoring_params, BlockAlignerWorkspace& workspace);
+
+// Copies a block-aligner CIGAR out of Rust memory, forwards or reversed (for
+// alignments run on reversed sequences).
+std::vector<OpLen> build_cigar_vector(const Cigar* cigar, size_t cigar_len);
+std::vector<OpLen> reverse_cigar_vector(const Cigar* cigar, size_t cigar_len);
+
+// Variants of the end extensions that append the CIGAR to `cigar` and leave
+// result.cigar empty.
+AlignmentResult free_query_end_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, CigarBuilder& cigar);
+AlignmentResult free_query_start_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, CigarBuilder& cigar);
+
+// Appends the CIGAR text of [begin, end) to `out` without temporary strings.
+void append_cigar_string(std::string& out, const OpLen* begin, const OpLen* end);
+
+// Globally aligns many short (query, ref) pairs at once, e.g. all inner anchor
+// gaps of one or more reads. Pairs are grouped by size and each group runs one
+// pair per SIMD lane; pairs longer than kBatchMaxLaneLength go through the block
+// aligner one by one. Results are written to `out` in input order.
+constexpr size_t kBatchLanes = 16;
+constexpr size_t kBatchMaxLaneLength = 64;
+
+void global_alignment_batch(const GapPair* pairs, size_t count, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out);
+void global_alignment_batch(const std::vector<GapPair>& pairs, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out);
+
+// Preset instantiation of the lane kernel; the AlignmentScoring overload
+// dispatches here when the scoring matches a preset.
+template <typename Preset>
+void global_alignment_batch(const GapPair* pairs, size_t count, const Preset& scoring_params, BlockAlignerWorkspace& workspace, BatchAlignmentResult& out);
+
+// Rough size in bytes of the trace the block aligner keeps for a traceback:
+// a couple of bits per cell of each block along the path.
+size_t estimated_trace_bytes(size_t query_len, size_t ref_len, size_t block_size);
+
+// Banded global alignment without a full trace. A Gotoh pass over a band
+// around the corner-to-corner diagonal keeps only every sqrt(n)-th row of
+// scores, n being the query length; the traceback then recomputes one stripe
+// of rows at a time from those checkpoints, last stripe first, with the
+// full-matrix tie-breaking. Memory is O(reference length) for the score rows
+// plus O(band * sqrt(n)) for the checkpoints and the stripe trace.
+//
+// The band's half-width starts at `band` plus the length difference of the
+// sequences and is doubled, with the pass repeated, while the best path runs
+// along one of its inner sides or scores below `min_score` (a score some
+// other aligner reached, so known to be possible). The result is the best
+// path within the final band: a better path that leaves a band the best one
+// stays clear of is not found. Appends the CIGAR to `cigar` and returns the
+// score.
+int checkpointed_global_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, size_t band, std::vector<OpLen>& cigar,
+                                  int min_score = std::numeric_limits<int>::min());
+
+// Global alignment of tiny pairs (at most kSmallGapMaxLength bases per side)
+// without the block aligner. Appends the CIGAR to `cigar` and returns the score.
+// global_alignment and global_alignment_batch use it automatically.
+constexpr size_t kSmallGapMaxLength = 8;
+
+int small_gap_alignment(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, std::vector<OpLen>& cigar);
+template <typename Preset>
+int small_gap_alignment(std::string_view query, std::string_view ref, const Preset& scoring_params, std::vector<OpLen>& cigar);
+
+// Score-only variants: no trace is stored and the CIGAR is left for
+// AlignmentResult::compute_cigar.
+AlignmentResult global_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+AlignmentResult free_query_end_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+AlignmentResult free_query_start_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params);
+
+AlignmentResult global_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
+AlignmentResult free_query_end_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
+AlignmentResult free_query_start_alignment_score(std::string_view query, std::string_view ref, const AlignmentScoring& scoring_params, BlockAlignerWorkspace& workspace);
 
 
 #endif
@@ -0,0 +1,303 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "baligner.hpp"
+#include "piecewise.hpp"
+#include "reference_cache.hpp"
+
+// Every C++ heap allocation goes through here so that allocs/op can be
+// reported. Allocations made inside the Rust block aligner are not seen.
+static size_t allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count++;
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kMinBenchSeconds = 0.2;
+const AlignmentScoring kScoring = {3, -1, -3, -1};
+// Matches no preset, so it measures the runtime-scoring kernels.
+const AlignmentScoring kGenericScoring = {2, -1, -3, -1};
+
+volatile long long sink = 0;
+std::string filter;
+
+// Runs `body` in batches of doubling size until one batch takes long enough,
+// then reports that batch. `cells` is the DP cells computed per call, or 0
+// when the benchmark has no DP.
+template <typename Body>
+void bench(const std::string& name, double cells, Body&& body) {
+    if (!filter.empty() && name.find(filter) == std::string::npos) return;
+    body();
+
+    size_t iterations = 1;
+    double seconds = 0;
+    size_t allocations = 0;
+    while (true) {
+        const size_t allocations_before = allocation_count;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) body();
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        allocations = allocation_count - allocations_before;
+        if (seconds >= kMinBenchSeconds) break;
+        iterations *= 2;
+    }
+
+    const double ns_per_op = seconds * 1e9 / iterations;
+    std::printf("%-44s %14.1f", name.c_str(), ns_per_op);
+    if (cells > 0) {
+        std::printf(" %14.3e", cells * iterations / seconds);
+    } else {
+        std::printf(" %14s", "-");
+    }
+    std::printf(" %12.2f\n", static_cast<double>(allocations) / iterations);
+}
+
+std::string random_sequence(size_t length, std::mt19937& rng) {
+    std::string seq(length, 'A');
+    for (auto& base : seq) base = "ACGT"[rng() & 3];
+    return seq;
+}
+
+// Copy of `seq` with substitutions, insertions and deletions at `error_rate`.
+std::string mutate(std::string_view seq, double error_rate, std::mt19937& rng) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::string out;
+    out.reserve(seq.length() + seq.length() / 8);
+    for (char base : seq) {
+        const double r = uniform(rng);
+        if (r < error_rate * 0.7) {
+            out.push_back("ACGT"[(rng() & 3)]);
+        } else if (r < error_rate * 0.85) {
+            continue;
+        } else if (r < error_rate) {
+            out.push_back("ACGT"[(rng() & 3)]);
+            out.push_back(base);
+        } else {
+            out.push_back(base);
+        }
+    }
+    return out;
+}
+
+struct SyntheticRead {
+    std::string query;
+    std::vector<Anchor> anchors;
+};
+
+// A read sampled from `reference` with errors, and the exact k-mer matches
+// along its true path as anchors, at least `spacing` bases apart.
+SyntheticRead make_read(const std::string& reference, size_t ref_begin, size_t length, double error_rate, int k, size_t spacing, std::mt19937& rng) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    SyntheticRead read;
+    std::vector<long> ref_of;
+    for (size_t ref_pos = ref_begin; ref_pos < ref_begin + length; ref_pos++) {
+        const double r = uniform(rng);
+        if (r < error_rate * 0.7) {
+            char base = "ACGT"[rng() & 3];
+            read.query.push_back(base);
+            ref_of.push_back(base == reference[ref_pos] ? static_cast<long>(ref_pos) : -1);
+        } else if (r < error_rate * 0.85) {
+            continue;
+        } else if (r < error_rate) {
+            read.query.push_back("ACGT"[rng() & 3]);
+            ref_of.push_back(-1);
+            read.query.push_back(reference[ref_pos]);
+            ref_of.push_back(ref_pos);
+        } else {
+            read.query.push_back(reference[ref_pos]);
+            ref_of.push_back(ref_pos);
+        }
+    }
+
+    size_t next = 0;
+    for (size_t i = 0; i + k <= read.query.length(); i++) {
+        if (i < next) continue;
+        bool exact = ref_of[i] >= 0;
+        for (int j = 1; exact && j < k; j++) exact = ref_of[i + j] == ref_of[i] + j;
+        if (!exact) continue;
+        read.anchors.push_back({static_cast<uint>(i), static_cast<uint>(ref_of[i])});
+        next = i + k + spacing;
+    }
+    return read;
+}
+
+void bench_ffi(std::mt19937& rng) {
+    const std::string one = random_sequence(1, rng);
+    BlockAlignerWorkspace workspace;
+    bench("ffi/global_score 1x1", 1, [&] {
+        sink += global_alignment_score(one, one, kScoring, workspace).score;
+    });
+
+    const std::string seq = random_sequence(64, rng);
+    PaddedBytes* padded = workspace.query_padded(seq.length(), 256);
+    bench("ffi/set_bytes 64", 0, [&] {
+        block_set_bytes_padded_aa(padded, reinterpret_cast<const uint8_t*>(seq.data()), seq.length(), 256);
+    });
+}
+
+void bench_block_alignment(std::mt19937& rng) {
+    using AlignFn = AlignmentResult (*)(std::string_view, std::string_view, const AlignmentScoring&, BlockAlignerWorkspace&);
+    struct Mode {
+        const char* name;
+        AlignFn align;
+    };
+    const Mode modes[] = {
+        {"global", global_alignment},
+        {"global_score", global_alignment_score},
+        {"free_query_end", free_query_end_alignment},
+        {"free_query_start", free_query_start_alignment},
+    };
+
+    BlockAlignerWorkspace workspace;
+    for (size_t length : {16, 64, 256, 1024, 4096}) {
+        const std::string ref = random_sequence(length, rng);
+        const std::string query = mutate(ref, 0.05, rng);
+        for (const Mode& mode : modes) {
+            bench(std::string("block/") + mode.name + " " + std::to_string(length), double(query.length()) * ref.length(), [&] {
+                sink += mode.align(query, ref, kScoring, workspace).score;
+            });
+        }
+    }
+
+    // One reference window aligned over and over, as for amplicon reads.
+    ReferenceWindowCache reference_cache;
+    AlignmentPolicy cached_policy;
+    cached_policy.reference_cache = &reference_cache;
+    BlockAlignerWorkspace cached_workspace;
+    cached_workspace.set_policy(cached_policy);
+    const std::string window = random_sequence(1024, rng);
+    const std::string window_read = mutate(window, 0.05, rng);
+    bench("block/free_query_end 1024 cached reference", double(window_read.length()) * window.length(), [&] {
+        sink += free_query_end_alignment(window_read, window, kScoring, cached_workspace).score;
+    });
+
+    const std::string small_ref = random_sequence(kSmallGapMaxLength, rng);
+    const std::string small_query = mutate(small_ref, 0.2, rng);
+    std::vector<OpLen> small_cigar;
+    bench("small_gap 8", double(small_query.length()) * small_ref.length(), [&] {
+        small_cigar.clear();
+        sink += small_gap_alignment(small_query, small_ref, kScoring, small_cigar);
+    });
+    bench("small_gap 8 generic scoring", double(small_query.length()) * small_ref.length(), [&] {
+        small_cigar.clear();
+        sink += small_gap_alignment(small_query, small_ref, kGenericScoring, small_cigar);
+    });
+
+    std::vector<std::string> gap_refs;
+    std::vector<std::string> gap_queries;
+    for (size_t i = 0; i < 256; i++) {
+        gap_refs.push_back(random_sequence(16 + rng() % 32, rng));
+        gap_queries.push_back(mutate(gap_refs.back(), 0.1, rng));
+    }
+    std::vector<GapPair> pairs;
+    double pair_cells = 0;
+    for (size_t i = 0; i < gap_refs.size(); i++) {
+        pairs.push_back({gap_queries[i], gap_refs[i]});
+        pair_cells += double(gap_queries[i].length()) * gap_refs[i].length();
+    }
+    BatchAlignmentResult batch_result;
+    bench("batch 256 gaps of 16-48", pair_cells, [&] {
+        global_alignment_batch(pairs, kScoring, workspace, batch_result);
+        sink += batch_result.scores[0];
+    });
+    bench("batch 256 gaps of 16-48 generic scoring", pair_cells, [&] {
+        global_alignment_batch(pairs, kGenericScoring, workspace, batch_result);
+        sink += batch_result.scores[0];
+    });
+}
+
+void bench_cigar(std::mt19937& rng) {
+    BlockAlignerWorkspace workspace;
+    const std::string ref = random_sequence(1024, rng);
+    const std::string query = mutate(ref, 0.05, rng);
+    AlignmentResult result = global_alignment(query, ref, kScoring, workspace);
+
+    // A block-aligner traceback of its own, so the CIGAR does not depend on
+    // which kernel global_alignment picked.
+    const size_t block_size = 256;
+    PaddedBytes* query_padded = workspace.query_padded(query.length(), block_size);
+    PaddedBytes* ref_padded = workspace.ref_padded(ref.length(), block_size);
+    block_set_bytes_padded_aa(query_padded, reinterpret_cast<const uint8_t*>(query.data()), query.length(), block_size);
+    block_set_bytes_padded_aa(ref_padded, reinterpret_cast<const uint8_t*>(ref.data()), ref.length(), block_size);
+    BlockHandle block = workspace.global_trace_block(query.length(), ref.length(), block_size);
+    block_align_aa_trace(block, query_padded, ref_padded, workspace.matrix(kScoring), {kScoring.gap_open, kScoring.gap_extend},
+                         {32, block_size}, 0);
+    const AlignResult traced = block_res_aa_trace(block);
+    Cigar* cigar = workspace.cigar(traced.query_idx, traced.reference_idx);
+    block_cigar_eq_aa_trace(block, query_padded, ref_padded, traced.query_idx, traced.reference_idx, cigar);
+    const size_t cigar_len = block_len_cigar(cigar);
+
+    bench("cigar/build_cigar_vector 1024", 0, [&] {
+        sink += build_cigar_vector(cigar, cigar_len).size();
+    });
+
+    std::vector<OpLen> elements;
+    const Operation ops[] = {Operation::Eq, Operation::X, Operation::I, Operation::D};
+    for (size_t i = 0; i < 1000; i++) elements.push_back({ops[rng() % 4], 1 + rng() % 20});
+    bench("cigar/merge_cigar_elements 1000", 0, [&] {
+        sink += merge_cigar_elements(elements).size();
+    });
+
+    CigarBuilder builder;
+    bench("cigar/builder append 1000", 0, [&] {
+        builder.clear();
+        for (const OpLen& element : elements) builder.push(element.op, element.len);
+        sink += builder.size();
+    });
+
+    bench("cigar/to_cigar_string 1024", 0, [&] {
+        sink += result.to_cigar_string().size();
+    });
+}
+
+void bench_piecewise(std::mt19937& rng) {
+    const int k = 15;
+    const std::string reference = random_sequence(1 << 16, rng);
+    BlockAlignerWorkspace workspace;
+    for (size_t length : {1000, 10000}) {
+        for (size_t spacing : {0, 50, 200}) {
+            SyntheticRead read = make_read(reference, 1000, length, 0.05, k, spacing, rng);
+            if (read.anchors.empty()) continue;
+            const std::string name = "piecewise " + std::to_string(length) + " spacing " + std::to_string(spacing) +
+                                     " (" + std::to_string(read.anchors.size()) + " anchors)";
+            bench(name, 0, [&] {
+                sink += piecewise_extension_alignment(read.query, reference, read.anchors, k, 10, kScoring, workspace).score;
+            });
+        }
+    }
+}
+
+}
+
+// Usage: bench [filter]. Only benchmarks whose name contains the filter run.
+int main(int argc, char** argv) {
+    if (argc > 1) filter = argv[1];
+    std::mt19937 rng(42);
+
+    std::printf("%-44s %14s %14s %12s\n", "benchmark", "ns/op", "cells/s", "allocs/op");
+    bench_ffi(rng);
+    bench_block_alignment(rng);
+    bench_cigar(rng);
+    bench_piecewise(rng);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "chaining.hpp"
+
+namespace {
+
+int gap_cost(int shift, int k) {
+    if (shift == 0) return 0;
+    return static_cast<int>(0.01f * k * shift + 0.5f * std::log2(static_cast<float>(shift)));
+}
+
+}
+
+std::vector<AnchorChain> chain_anchors(const std::vector<Anchor>& anchors, const ChainingParams& params) {
+    const size_t n = anchors.size();
+    std::vector<AnchorChain> chains;
+    if (n == 0) return chains;
+
+    std::vector<Anchor> sorted(anchors);
+    std::sort(sorted.begin(), sorted.end(), [](const Anchor& a, const Anchor& b) {
+        return a.ref_start != b.ref_start ? a.ref_start < b.ref_start : a.query_start < b.query_start;
+    });
+
+    std::vector<int> score(n);
+    std::vector<int64_t> parent(n, -1);
+    for (size_t i = 0; i < n; i++) {
+        const int64_t qi = sorted[i].query_start;
+        const int64_t ri = sorted[i].ref_start;
+        int best = params.k;
+        int64_t best_parent = -1;
+        size_t lookback_end = i > static_cast<size_t>(params.max_lookback) ? i - params.max_lookback : 0;
+        for (size_t j = i; j-- > lookback_end;) {
+            const int64_t dr = ri - sorted[j].ref_start;
+            if (dr > params.max_gap) break;
+            const int64_t dq = qi - sorted[j].query_start;
+            if (dr <= 0 || dq <= 0 || dq > params.max_gap) continue;
+            const int shift = static_cast<int>(std::abs(dq - dr));
+            if (shift > params.max_diagonal_shift) continue;
+            int gained = static_cast<int>(std::min<int64_t>(std::min(dq, dr), params.k));
+            int candidate = score[j] + gained - gap_cost(shift, params.k);
+            if (candidate > best) {
+                best = candidate;
+                best_parent = j;
+            }
+        }
+        score[i] = best;
+        parent[i] = best_parent;
+    }
+
+    // Chains are peeled off from the best remaining end. A chain stops where it
+    // runs into an anchor already claimed by a better chain, and its score is
+    // counted only from that point on.
+    std::vector<size_t> ends(n);
+    for (size_t i = 0; i < n; i++) ends[i] = i;
+    std::sort(ends.begin(), ends.end(), [&score](size_t a, size_t b) { return score[a] > score[b]; });
+    std::vector<bool> used(n, false);
+    for (size_t end : ends) {
+        if (chains.size() >= params.max_chains) break;
+        if (used[end]) continue;
+        int64_t i = end;
+        while (i >= 0 && !used[i]) {
+            i = parent[i];
+        }
+        int chain_score = score[end] - (i >= 0 ? score[i] : 0);
+        if (chain_score < params.min_chain_score) continue;
+
+        AnchorChain chain;
+        chain.score = chain_score;
+        for (int64_t j = end; j != i; j = parent[j]) {
+            used[j] = true;
+            chain.anchors.push_back(sorted[j]);
+        }
+        std::reverse(chain.anchors.begin(), chain.anchors.end());
+        chains.push_back(std::move(chain));
+    }
+    return chains;
+}
@@ -0,0 +1,34 @@
+#ifndef ANCHOR_CHAINING_H
+#define ANCHOR_CHAINING_H
+#include <cstddef>
+#include <vector>
+#include "piecewise.hpp"
+
+struct ChainingParams {
+    int k;
+    // Number of preceding anchors (in reference order) considered as
+    // predecessors of each anchor.
+    int max_lookback = 50;
+    // Largest query or reference distance bridged between two chained anchors.
+    int max_gap = 5000;
+    // Largest difference between the query and reference distances, i.e. the
+    // largest indel allowed between two chained anchors.
+    int max_diagonal_shift = 500;
+    int min_chain_score = 0;
+    size_t max_chains = 1;
+};
+
+struct AnchorChain {
+    int score;
+    std::vector<Anchor> anchors;
+};
+
+// Minimap2-style chaining: anchors are sorted by reference then query
+// position, and each anchor takes the best of its last `max_lookback`
+// predecessors, scored by the bases the pair adds minus a gap cost that grows
+// with the diagonal shift. Chains are returned best first, sorted and strictly
+// increasing in both coordinates, ready for piecewise_extension_alignment.
+// Each anchor is used by at most one chain. Sorting dominates: O(n log n + n h).
+std::vector<AnchorChain> chain_anchors(const std::vector<Anchor>& anchors, const ChainingParams& params);
+
+#endif
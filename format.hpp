@@ -0,0 +1,54 @@
+#ifndef FAST_FORMAT_H
+#define FAST_FORMAT_H
+#include <cstdint>
+#include <string>
+
+// Integer formatting into a caller-owned buffer, two digits at a time. Used
+// on the output hot path instead of std::to_string, which allocates a
+// temporary string per number.
+inline char* format_decimal(char* end, uint64_t value) {
+    static const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+    char* p = end;
+    while (value >= 100) {
+        const char* pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (value >= 10) {
+        const char* pair = digit_pairs + value * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    return p;
+}
+
+inline void append_uint(std::string& out, uint64_t value) {
+    char buffer[20];
+    char* end = buffer + sizeof(buffer);
+    char* begin = format_decimal(end, value);
+    out.append(begin, end - begin);
+}
+
+inline void append_int(std::string& out, int64_t value) {
+    if (value < 0) {
+        out.push_back('-');
+        append_uint(out, static_cast<uint64_t>(-(value + 1)) + 1);
+    } else {
+        append_uint(out, static_cast<uint64_t>(value));
+    }
+}
+
+#endif
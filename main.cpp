@@ -1,145 +1,27 @@
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <sstream>
+#include "alignment_cache.hpp"
 #include "baligner.hpp"
+#include "piecewise.hpp"
+#include "chaining.hpp"
+#include "minimizer_index.hpp"
+#include "packed_sequence.hpp"
+#include "pipeline.hpp"
+#include "reference_cache.hpp"
+#include "sequence_view.hpp"
 
 
-struct Anchor {
-    uint query_start;
-    uint ref_start;
-};
-
-std::vector<OpLen> merge_cigar_elements(const std::vector<OpLen>& elements) {
-    if (elements.empty()) {
-        return {};
-    }
-    std::vector<OpLen> merged_elements;
-    merged_elements.push_back(elements[0]);
-    for (size_t i = 1; i < elements.size(); ++i) {
-        if (elements[i].op == merged_elements.back().op) {
-            merged_elements.back().len += elements[i].len;
-        } else {
-            merged_elements.push_back(elements[i]);
-        }
-    }
-    return merged_elements;
-}
-
-AlignmentResult piecewise_extension_alignment(
-    const std::string& query,
-    const std::string& reference,
-    const std::vector<Anchor>& anchors,
-    const int k,
-    const int padding,
-    const AlignmentScoring& scoring_params
-) {
-    AlignmentResult result;
-    result.score = 0;
-    std::vector<OpLen> temp_cigar_elements;
-
-    const Anchor& first_anchor = anchors[0];
-    if (first_anchor.query_start > 0 && first_anchor.ref_start > 0) {
-        std::string query_part = query.substr(0, first_anchor.query_start);
-        const size_t ref_start = std::max(0, static_cast<int>(first_anchor.ref_start) - (static_cast<int>(query_part.length()) + padding));
-        std::string ref_part = reference.substr(ref_start, first_anchor.ref_start - ref_start);
-
-        AlignmentResult pre_align = free_query_start_alignment(query_part, ref_part, scoring_params);
-
-        if (pre_align.score == 0) {
-            result.query_start = first_anchor.query_start;
-            result.ref_start = first_anchor.ref_start;
-        } else {
-            result.score += pre_align.score;
-            result.query_start = pre_align.query_start;
-            result.ref_start = ref_start + pre_align.ref_start;
-            temp_cigar_elements.insert(temp_cigar_elements.end(), pre_align.cigar.begin(), pre_align.cigar.end());
-        }
-    } else {
-        result.query_start = first_anchor.query_start;
-        result.ref_start = first_anchor.ref_start;
-    }
-
-    result.score += k * scoring_params.match;
-    temp_cigar_elements.push_back({Operation::Eq, (uintptr_t)k});
-
-    for (size_t i = 1; i < anchors.size(); ++i) {
-        const Anchor& anchor = anchors[i];
-        const Anchor& prev_anchor = anchors[i - 1];
-
-        int curr_start_query = anchor.query_start;
-        int curr_start_ref = anchor.ref_start;
-        int prev_end_query = prev_anchor.query_start + k;
-        int prev_end_ref = prev_anchor.ref_start + k;
-
-        int ref_diff = curr_start_ref - prev_end_ref;
-        int query_diff = curr_start_query - prev_end_query;
-
-        if (ref_diff > 0 && query_diff > 0){
-            std::string query_part = query.substr(prev_end_query, query_diff);
-            std::string ref_part = reference.substr(prev_end_ref, ref_diff);
-
-            AlignmentResult aligned = global_alignment(query_part, ref_part, scoring_params);
-            result.score += aligned.score;
-            temp_cigar_elements.insert(temp_cigar_elements.end(), aligned.cigar.begin(), aligned.cigar.end());
-
-            result.score += k * scoring_params.match;
-            temp_cigar_elements.push_back({Operation::Eq, (uintptr_t)k});
-        } else {
-             if (ref_diff < query_diff) {
-                const size_t inserted_part = -ref_diff + query_diff;
-                result.score += scoring_params.gap_open + (inserted_part - 1) * scoring_params.gap_extend;
-                temp_cigar_elements.push_back({Operation::I, (uintptr_t)inserted_part});
-
-                const size_t matching_part = k + ref_diff;
-                result.score += matching_part * scoring_params.match;
-                temp_cigar_elements.push_back({Operation::Eq, (uintptr_t)matching_part});
-            } else if (ref_diff > query_diff) {
-                const size_t deleted_part = -query_diff + ref_diff;
-                result.score += scoring_params.gap_open + (deleted_part - 1) * scoring_params.gap_extend;
-                temp_cigar_elements.push_back({Operation::D, (uintptr_t)deleted_part});
-
-                const size_t matching_part = k + query_diff;
-                result.score += matching_part * scoring_params.match;
-                temp_cigar_elements.push_back({Operation::Eq, (uintptr_t)matching_part});
-            } else {
-                const size_t matching_part = k + ref_diff;
-                result.score += matching_part * scoring_params.match;
-                temp_cigar_elements.push_back({Operation::Eq, (uintptr_t)matching_part});
-            }
-        }
-    }
-
-    const Anchor& last_anchor = anchors.back();
-    const size_t last_anchor_end_query = last_anchor.query_start + k;
-    const size_t last_anchor_end_ref = last_anchor.ref_start + k;
-    if (last_anchor_end_query < query.length() && last_anchor_end_ref < reference.length()) {
-        std::string query_part = query.substr(last_anchor_end_query);
-        const size_t ref_part_end = std::min(reference.length(), last_anchor_end_ref + query_part.length() + padding);
-        std::string ref_part = reference.substr(last_anchor_end_ref, ref_part_end - last_anchor_end_ref);
-
-        AlignmentResult post_align = free_query_end_alignment(query_part, ref_part, scoring_params);
-
-        if (post_align.score == 0) {
-            result.query_end = last_anchor_end_query;
-            result.ref_end = last_anchor_end_ref;
-        } else {
-            result.score += post_align.score;
-            result.query_end = last_anchor_end_query + post_align.query_end;
-            result.ref_end = last_anchor_end_ref + post_align.ref_end;
-            temp_cigar_elements.insert(temp_cigar_elements.end(), post_align.cigar.begin(), post_align.cigar.end());
-        }
-    } else {
-        result.query_end = last_anchor_end_query;
-        result.ref_end = last_anchor_end_ref;
-    }
-
-    result.cigar = merge_cigar_elements(temp_cigar_elements);
-    return result;
-}
-
 void visualize_alignment(const std::string& query, const std::string& reference, const AlignmentResult& result) {
     std::stringstream aligned_query_ss;
     std::stringstream aligned_ref_ss;
@@ -221,6 +103,7 @@ bool validate_test(const std::string& query, const std::string& reference, const
         return false;
     }
     
+    PackedSequence packed_reference(reference);
     for (size_t i = 0; i < anchors.size(); ++i) {
         const Anchor& anchor = anchors[i];
         
@@ -236,10 +119,9 @@ bool validate_test(const std::string& query, const std::string& reference, const
             return false;
         }
         
-        std::string query_kmer = query.substr(anchor.query_start, k);
-        std::string ref_kmer = reference.substr(anchor.ref_start, k);
-        
-        if (query_kmer != ref_kmer) {
+        if (!packed_reference.matches(anchor.ref_start, std::string_view(query).substr(anchor.query_start, k))) {
+            std::string query_kmer = query.substr(anchor.query_start, k);
+            std::string ref_kmer = packed_reference.unpack(anchor.ref_start, k);
             std::cout << RED << "ERROR: Anchor " << i << " mismatch - Query: '" << query_kmer 
                       << "' vs Ref: '" << ref_kmer << "'" << RESET << std::endl;
             return false;
@@ -513,7 +395,8 @@ int main() {
     };
 
     int passed_tests = 0;
-    int total_tests = test_cases.size();
+    int total_tests = test_cases.size() + 14;
+    int test_number = 0;
 
     std::cout << BLUE << "=== PIECEWISE ALIGNMENT TEST SUITE ===" << RESET << std::endl;
     std::cout << BLUE << "Running " << total_tests << " tests..." << RESET << std::endl << std::endl;
@@ -521,7 +404,7 @@ int main() {
     for (size_t i = 0; i < test_cases.size(); ++i) {
         const auto& test = test_cases[i];
         
-        std::cout << YELLOW << "Test " << (i + 1) << ": " << test.name << RESET << std::endl;
+        std::cout << YELLOW << "Test " << ++test_number << ": " << test.name << RESET << std::endl;
         std::cout << "Query: " << test.query << std::endl;
         std::cout << "Ref:   " << test.reference << std::endl;
         std::cout << "Anchors: ";
@@ -560,6 +443,644 @@ int main() {
         std::cout << "----------------------------------------" << std::endl << std::endl;
     }
 
+    // The multithreaded driver must reproduce the serial results, in input order.
+    std::cout << YELLOW << "Test " << ++test_number << ": Multithreaded batch driver" << RESET << std::endl;
+    std::vector<PiecewiseRead> batch_reads;
+    std::vector<AlignmentResult> serial_results;
+    for (const auto& test : test_cases) {
+        if (test.k != 3 || test.padding != 2 || !validate_test(test.query, test.reference, test.anchors, test.k)) {
+            continue;
+        }
+        batch_reads.push_back({test.query, test.reference, &test.anchors});
+        serial_results.push_back(piecewise_extension_alignment(
+            test.query, test.reference, test.anchors, test.k, test.padding, default_scoring));
+    }
+    std::vector<AlignmentResult> batch_results = align_batch(batch_reads, {3, 2, default_scoring}, 4);
+    bool batch_matches = batch_results.size() == serial_results.size();
+    for (size_t i = 0; batch_matches && i < batch_results.size(); ++i) {
+        batch_matches = batch_results[i].score == serial_results[i].score &&
+                        batch_results[i].to_cigar_string() == serial_results[i].to_cigar_string();
+    }
+    // Concurrent callers on one pool, as in the CLI's align stage, share the
+    // workers' workspaces; each batch must still be aligned under its own
+    // policy. Every other caller soft-clips.
+    AlignmentPolicy clipping_policy;
+    clipping_policy.soft_clip = true;
+    BlockAlignerWorkspace clipping_workspace;
+    clipping_workspace.set_policy(clipping_policy);
+    std::vector<AlignmentResult> clipped_results;
+    for (const auto& read : batch_reads) {
+        clipped_results.push_back(piecewise_extension_alignment(read.query, read.reference, *read.anchors, 3, 2, default_scoring, clipping_workspace));
+    }
+    WorkStealingPool shared_pool(3);
+    std::vector<std::vector<std::vector<AlignmentResult>>> caller_results(4);
+    std::vector<std::thread> callers;
+    for (size_t c = 0; c < caller_results.size(); ++c) {
+        callers.emplace_back([&, c] {
+            PiecewiseParams caller_params = {3, 2, default_scoring};
+            if (c % 2) caller_params.policy = clipping_policy;
+            for (size_t round = 0; round < 3; ++round) {
+                caller_results[c].push_back(align_batch(batch_reads, caller_params, shared_pool));
+            }
+        });
+    }
+    for (auto& caller : callers) caller.join();
+    for (size_t c = 0; c < caller_results.size(); ++c) {
+        const std::vector<AlignmentResult>& expected = c % 2 ? clipped_results : serial_results;
+        for (const auto& round : caller_results[c]) {
+            for (size_t i = 0; batch_matches && i < round.size(); ++i) {
+                batch_matches = round[i].score == expected[i].score && round[i].to_cigar_string() == expected[i].to_cigar_string();
+            }
+        }
+    }
+    // An anchor past the end of its read must come out of align_batch as an
+    // exception instead of ending the process.
+    std::vector<Anchor> bad_anchors = {{1000, 1000}, {1010, 1010}};
+    try {
+        align_batch({{test_cases[0].query, test_cases[0].reference, &bad_anchors}}, {3, 2, default_scoring}, 2);
+        batch_matches = false;
+    } catch (const std::out_of_range&) {
+    }
+    std::cout << "Reads: " << batch_reads.size() << std::endl;
+    if (batch_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Batch results differ from serial results" << RESET << std::endl << std::endl;
+    }
+
+    // Chaining must recover the clean chain of test 1 from anchors mixed with
+    // off-diagonal and repeated hits.
+    std::cout << YELLOW << "Test " << ++test_number << ": Chaining noisy anchors" << RESET << std::endl;
+    const TestCase& chain_test = test_cases[0];
+    std::vector<Anchor> noisy_anchors = {{12, 2}, {2, 6}, {0, 20}, {7, 11}, {7, 3}, {12, 17}, {14, 0}};
+    std::vector<AnchorChain> chains = chain_anchors(noisy_anchors, {chain_test.k});
+    bool chain_matches = !chains.empty() && chains[0].anchors.size() == chain_test.anchors.size();
+    for (size_t i = 0; chain_matches && i < chains[0].anchors.size(); ++i) {
+        chain_matches = chains[0].anchors[i].query_start == chain_test.anchors[i].query_start &&
+                        chains[0].anchors[i].ref_start == chain_test.anchors[i].ref_start;
+    }
+    if (chain_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Chain differs from the expected anchors" << RESET << std::endl << std::endl;
+    }
+
+    // Every anchor found through the index must be an exact k-mer match, a
+    // saved and reloaded index must give the same anchors, and a corrupt
+    // header must not load.
+    std::cout << YELLOW << "Test " << ++test_number << ": Minimizer index anchors" << RESET << std::endl;
+    const TestCase& index_test = test_cases[0];
+    std::vector<Contig> index_contigs = {{"ref", index_test.reference}};
+    MinimizerParams index_params = {5, 3};
+    WorkStealingPool index_pool(2);
+    const std::string index_path = "test_minimizer_index.tmp";
+    MinimizerIndex::build(index_contigs, index_params, index_pool).save(index_path);
+    MinimizerIndex built = MinimizerIndex::build(index_contigs, index_params, index_pool);
+    MinimizerIndex loaded = MinimizerIndex::load(index_path);
+    // A header whose k or bucket bits are out of range, or whose names block
+    // would misalign the tables after it, must be rejected.
+    size_t corrupt_rejected = 0;
+    for (const auto& [field_offset, value] : {std::pair<long, uint32_t>{8, 40}, {16, 64}, {40, 4}}) {
+        uint32_t saved;
+        std::fstream index_file(index_path, std::ios::binary | std::ios::in | std::ios::out);
+        index_file.seekg(field_offset);
+        index_file.read(reinterpret_cast<char*>(&saved), sizeof(saved));
+        index_file.seekp(field_offset);
+        index_file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        index_file.close();
+        try {
+            MinimizerIndex::load(index_path);
+        } catch (const std::runtime_error&) {
+            corrupt_rejected++;
+        }
+        index_file.open(index_path, std::ios::binary | std::ios::in | std::ios::out);
+        index_file.seekp(field_offset);
+        index_file.write(reinterpret_cast<const char*>(&saved), sizeof(saved));
+    }
+    std::remove(index_path.c_str());
+    std::vector<ContigAnchors> built_hits;
+    std::vector<ContigAnchors> loaded_hits;
+    built.find_anchors(index_test.query, built_hits);
+    loaded.find_anchors(index_test.query, loaded_hits);
+    bool index_matches = corrupt_rejected == 3 && built_hits.size() == 1 && loaded_hits.size() == 1 &&
+                         built_hits[0].anchors.size() == loaded_hits[0].anchors.size() && !built_hits[0].anchors.empty();
+    for (size_t i = 0; index_matches && i < built_hits[0].anchors.size(); ++i) {
+        const Anchor& a = built_hits[0].anchors[i];
+        index_matches = a.query_start == loaded_hits[0].anchors[i].query_start &&
+                        a.ref_start == loaded_hits[0].anchors[i].ref_start &&
+                        index_test.query.substr(a.query_start, index_params.k) == index_test.reference.substr(a.ref_start, index_params.k);
+    }
+    if (index_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Index anchors are wrong, differ after reload or a corrupt index loaded" << RESET << std::endl << std::endl;
+    }
+
+    // A wrapped FASTA must read back the same bases from any window of the
+    // mapping, index the same as its flat sequence, and reads aligned in one
+    // batch against windows that share coordinates must not mix their anchors.
+    std::cout << YELLOW << "Test " << ++test_number << ": Mapped reference windows" << RESET << std::endl;
+    const std::string fasta_path = "test_mapped_reference.tmp";
+    const std::string wrapped = index_test.reference;
+    bool mapped_matches = false;
+    {
+        std::ofstream fasta(fasta_path, std::ios::binary);
+        fasta << ">ragged\nACGTACGT\nACG\nACGT\n";
+    }
+    try {
+        MappedReference ragged(fasta_path);
+    } catch (const std::runtime_error&) {
+        mapped_matches = true;
+    }
+    {
+        std::ofstream fasta(fasta_path, std::ios::binary | std::ios::trunc);
+        fasta << ">wrapped desc\n";
+        for (size_t pos = 0; pos < wrapped.length(); pos += 7) fasta << wrapped.substr(pos, 7) << "\n";
+        fasta << "\n>flat\n" << wrapped << "\n";
+    }
+    MappedReference mapped(fasta_path);
+    std::string window_buffer;
+    // The layout read from a .fai must match the scanned one, and an index
+    // that points past the FASTA must be rejected.
+    const std::string fai_path = fasta_path + ".fai";
+    {
+        std::ofstream fai(fai_path, std::ios::binary);
+        for (const MappedContig& contig : mapped.contigs()) {
+            fai << contig.name << "\t" << contig.length << "\t" << contig.offset << "\t" << contig.line_bases << "\t"
+                << contig.line_width << "\n";
+        }
+    }
+    {
+        MappedReference indexed(fasta_path);
+        mapped_matches = mapped_matches && indexed.contigs().size() == 2;
+        for (size_t c = 0; mapped_matches && c < 2; ++c) {
+            const MappedContig& expected = mapped.contigs()[c];
+            const MappedContig& contig = indexed.contigs()[c];
+            std::string expected_buffer;
+            mapped_matches = contig.name == expected.name && contig.length == expected.length && contig.offset == expected.offset &&
+                             indexed.bases(contig, 3, 30, window_buffer) == mapped.bases(expected, 3, 30, expected_buffer);
+        }
+    }
+    {
+        std::ofstream fai(fai_path, std::ios::binary | std::ios::trunc);
+        fai << "wrapped\t" << wrapped.length() * 8 << "\t14\t7\t8\n";
+    }
+    try {
+        MappedReference stale(fasta_path);
+        mapped_matches = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::remove(fai_path.c_str());
+    std::remove(fasta_path.c_str());
+    mapped_matches = mapped_matches && mapped.contigs().size() == 2 && mapped.contigs()[0].name == "wrapped" &&
+                     mapped.contigs()[0].length == wrapped.length() && mapped.find("flat") == &mapped.contigs()[1];
+    for (size_t pos = 0; mapped_matches && pos <= wrapped.length(); ++pos) {
+        for (size_t len : {size_t(0), size_t(1), size_t(6), size_t(7), size_t(20), wrapped.length()}) {
+            mapped_matches = mapped_matches && mapped.bases(mapped.contigs()[0], pos, len, window_buffer) == wrapped.substr(pos, len) &&
+                             mapped.bases(mapped.contigs()[1], pos, len, window_buffer) == wrapped.substr(pos, len);
+        }
+    }
+    std::vector<ContigAnchors> mapped_hits;
+    MinimizerIndex::build(mapped, index_params, index_pool).find_anchors(index_test.query, mapped_hits);
+    mapped_matches = mapped_matches && mapped_hits.size() == 2 && mapped_hits[0].anchors.size() == built_hits[0].anchors.size();
+    for (size_t i = 0; mapped_matches && i < built_hits[0].anchors.size(); ++i) {
+        mapped_matches = mapped_hits[0].anchors[i].query_start == built_hits[0].anchors[i].query_start &&
+                         mapped_hits[0].anchors[i].ref_start == built_hits[0].anchors[i].ref_start;
+    }
+    const std::string window_read = "ACGTTGCATGCA";
+    const std::vector<Anchor> first_window_anchors = {{0, 0}};
+    const std::vector<Anchor> second_window_anchors = {{2, 2}};
+    std::vector<AlignmentResult> window_results = align_batch(
+        {{window_read, window_read, &first_window_anchors}, {window_read, window_read, &second_window_anchors}}, {3, 2, default_scoring}, 1);
+    mapped_matches = mapped_matches && window_results[0].to_cigar_string() == "12=" && window_results[1].to_cigar_string() == "12=";
+    if (mapped_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Mapped reference windows differ from the flat sequence" << RESET << std::endl << std::endl;
+    }
+
+    // Aligning against the packed reference must give the same alignments.
+    std::cout << YELLOW << "Test " << ++test_number << ": Packed reference alignment" << RESET << std::endl;
+    BlockAlignerWorkspace packed_workspace;
+    bool packed_matches = true;
+    for (const auto& test : test_cases) {
+        PackedSequence packed_reference(test.reference);
+        AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+        AlignmentResult packed = piecewise_extension_alignment(test.query, packed_reference, test.anchors, test.k, test.padding, default_scoring, packed_workspace);
+        if (packed.score != expected.score || packed.ref_start != expected.ref_start || packed.ref_end != expected.ref_end ||
+            packed.query_start != expected.query_start || packed.query_end != expected.query_end ||
+            packed.to_cigar_string() != expected.to_cigar_string() || packed_reference.unpack(0, test.reference.length()) != test.reference) {
+            std::cout << RED << "Mismatch on " << test.name << RESET << std::endl;
+            packed_matches = false;
+        }
+    }
+    if (packed_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Packed alignments differ" << RESET << std::endl << std::endl;
+    }
+
+    // In local mode, ends that cannot be aligned (here G/T junk around an A/C
+    // read) are reported as soft clips in the CIGAR.
+    std::cout << YELLOW << "Test " << ++test_number << ": Local mode soft clips" << RESET << std::endl;
+    std::string local_reference;
+    uint32_t lcg = 12345;
+    for (size_t i = 0; i < 400; ++i) {
+        lcg = lcg * 1103515245 + 12345;
+        local_reference += "AC"[(lcg >> 16) & 1];
+    }
+    const std::string local_query = std::string(30, 'G') + local_reference.substr(100, 200) + std::string(600, 'T');
+    std::vector<Anchor> local_anchors;
+    for (uint i = 0; i + 11 <= 200; i += 20) {
+        local_anchors.push_back({30 + i, 100 + i});
+    }
+    AlignmentPolicy local_policy;
+    local_policy.soft_clip = true;
+    BlockAlignerWorkspace local_workspace;
+    local_workspace.set_policy(local_policy);
+    AlignmentResult local = piecewise_extension_alignment(local_query, local_reference, local_anchors, 11, 10, default_scoring, local_workspace);
+    std::cout << "CIGAR: " << local.to_cigar_string() << std::endl;
+    if (local.to_cigar_string() == "30S200=600S" && local.query_start == 30 && local.query_end == 230 &&
+        local.ref_start == 100 && local.ref_end == 300 && validate_alignment(local_query, local_reference, local)) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Junk ends are not soft-clipped" << RESET << std::endl << std::endl;
+    }
+
+    // A 3 kb gap between the only two anchors is re-seeded instead of going to
+    // the DP whole; the substitutions every 50 bases must still come out as X.
+    std::cout << YELLOW << "Test " << ++test_number << ": Re-seeding a large gap" << RESET << std::endl;
+    std::string reseed_reference;
+    for (size_t i = 0; i < 3100; ++i) {
+        lcg = lcg * 1103515245 + 12345;
+        reseed_reference += "ACGT"[(lcg >> 16) & 3];
+    }
+    std::string reseed_query = reseed_reference;
+    std::string expected_cigar;
+    for (size_t i = 25; i < reseed_query.length() - 50; i += 50) {
+        reseed_query[i] = reseed_query[i] == 'A' ? 'C' : 'A';
+        expected_cigar += (i == 25 ? "25=1X" : "49=1X");
+    }
+    expected_cigar += "74=";
+    std::vector<Anchor> reseed_anchors = {{0, 0}, {3080, 3080}};
+    BlockAlignerWorkspace reseed_workspace;
+    AlignmentResult reseeded = piecewise_extension_alignment(reseed_query, reseed_reference, reseed_anchors, 15, 10, default_scoring, reseed_workspace);
+    if (reseeded.to_cigar_string() == expected_cigar && reseeded.query_end == reseed_query.length() &&
+        validate_alignment(reseed_query, reseed_reference, reseeded)) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Re-seeded alignment differs from the expected CIGAR" << RESET << std::endl << std::endl;
+    }
+
+    // With a trace budget too small for any block, every traceback takes the
+    // checkpointed path and must still find alignments of the same score.
+    // The CIGAR may differ, as the checkpointed pass breaks ties its own way.
+    std::cout << YELLOW << "Test " << ++test_number << ": Memory-bounded traceback" << RESET << std::endl;
+    AlignmentPolicy bounded_policy;
+    bounded_policy.trace_budget = 1;
+    BlockAlignerWorkspace bounded_workspace;
+    bounded_workspace.set_policy(bounded_policy);
+    bool bounded_matches = true;
+    for (const auto& test : test_cases) {
+        AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+        AlignmentResult bounded = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring, bounded_workspace);
+        if (bounded.score != expected.score || !validate_alignment(test.query, test.reference, bounded)) {
+            std::cout << RED << "Mismatch on " << test.name << RESET << std::endl;
+            bounded_matches = false;
+        }
+    }
+    // A 3 kb gap over a realistic budget: only the score has to agree, as
+    // ties may be broken differently.
+    AlignmentPolicy whole_gap_policy;
+    whole_gap_policy.reseed_gap = 0;
+    BlockAlignerWorkspace whole_gap_workspace;
+    whole_gap_workspace.set_policy(whole_gap_policy);
+    whole_gap_policy.trace_budget = size_t(256) << 10;
+    bounded_workspace.set_policy(whole_gap_policy);
+    AlignmentResult whole_gap = piecewise_extension_alignment(reseed_query, reseed_reference, reseed_anchors, 15, 10, default_scoring, whole_gap_workspace);
+    AlignmentResult bounded_gap = piecewise_extension_alignment(reseed_query, reseed_reference, reseed_anchors, 15, 10, default_scoring, bounded_workspace);
+    bounded_matches = bounded_matches && estimated_trace_bytes(3065, 3065, 256) > whole_gap_policy.trace_budget &&
+                      bounded_gap.score == whole_gap.score && validate_alignment(reseed_query, reseed_reference, bounded_gap);
+    // Indels far off the corner-to-corner diagonal: a 500 bp deletion at the
+    // start, which the band must reach from the outset to find the exact
+    // alignment (that of a band as wide as the reference), and a 300 bp
+    // deletion and insertion that cancel out, where the band has to widen to
+    // score at least as well as the unbounded traceback.
+    std::string off_diagonal;
+    for (size_t i = 0; i < 3500; ++i) {
+        lcg = lcg * 1103515245 + 12345;
+        off_diagonal += "ACGT"[(lcg >> 16) & 3];
+    }
+    const std::string off_deleted = off_diagonal.substr(500);
+    const std::string off_shifted_ref = off_diagonal.substr(0, 2300);
+    const std::string off_shifted = off_diagonal.substr(300, 2000) + off_diagonal.substr(2400, 300);
+    for (const auto& [off_query, off_ref] : {std::pair{off_deleted, off_diagonal}, std::pair{off_shifted, off_shifted_ref}}) {
+        AlignmentResult unbounded = global_alignment(off_query, off_ref, default_scoring);
+        AlignmentResult banded = global_alignment(off_query, off_ref, default_scoring, bounded_workspace);
+        std::vector<OpLen> exact_cigar;
+        const int exact_score = checkpointed_global_alignment(off_query, off_ref, default_scoring, off_ref.length(), exact_cigar);
+        bounded_matches = bounded_matches && banded.score >= unbounded.score && validate_alignment(off_query, off_ref, banded) &&
+                          (off_query.length() == off_ref.length() || banded.score == exact_score);
+    }
+    if (bounded_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Bounded tracebacks differ" << RESET << std::endl << std::endl;
+    }
+
+    // A score-only alignment whose CIGAR is computed later must keep the score
+    // and coordinates it was ranked by, in every mode. The read is the
+    // reference with substitutions and small indels; for the free-end modes
+    // it also carries unrelated bases at its free end.
+    std::cout << YELLOW << "Test " << ++test_number << ": Deferred traceback keeps the score" << RESET << std::endl;
+    auto random_bases = [&](size_t length) {
+        std::string bases;
+        for (size_t i = 0; i < length; ++i) {
+            lcg = lcg * 1103515245 + 12345;
+            bases += "ACGT"[(lcg >> 16) & 3];
+        }
+        return bases;
+    };
+    using ScoreOnly = AlignmentResult (*)(std::string_view, std::string_view, const AlignmentScoring&);
+    const std::pair<AlignmentMode, ScoreOnly> score_only_modes[] = {{AlignmentMode::Global, global_alignment_score},
+                                                                    {AlignmentMode::FreeQueryEnd, free_query_end_alignment_score},
+                                                                    {AlignmentMode::FreeQueryStart, free_query_start_alignment_score}};
+    bool deferred_matches = true;
+    for (size_t length : {size_t(40), size_t(300), size_t(2000)}) {
+        const std::string deferred_ref = random_bases(length);
+        std::string deferred_read;
+        for (size_t i = 0; i < length; ++i) {
+            if (i % 53 == 20) continue;
+            if (i % 71 == 30) deferred_read += "GA";
+            deferred_read += i % 37 == 10 ? "ACGT"[(std::string_view("ACGT").find(deferred_ref[i]) + 1) % 4] : deferred_ref[i];
+        }
+        const std::string junk = random_bases(length / 4 + 10);
+        for (const auto& [mode, align_score] : score_only_modes) {
+            const std::string query = mode == AlignmentMode::FreeQueryEnd ? deferred_read + junk
+                                      : mode == AlignmentMode::FreeQueryStart ? junk + deferred_read
+                                                                              : deferred_read;
+            const std::string ref = mode == AlignmentMode::FreeQueryEnd ? deferred_ref + random_bases(50)
+                                    : mode == AlignmentMode::FreeQueryStart ? random_bases(50) + deferred_ref
+                                                                            : deferred_ref;
+            AlignmentResult deferred = align_score(query, ref, default_scoring);
+            const AlignmentResult ranked = deferred;
+            deferred.compute_cigar();
+            if (!deferred.has_cigar() || deferred.score != ranked.score || deferred.query_start != ranked.query_start ||
+                deferred.query_end != ranked.query_end || deferred.ref_start != ranked.ref_start || deferred.ref_end != ranked.ref_end ||
+                !validate_alignment(query, ref, deferred)) {
+                std::cout << RED << "Mismatch for mode " << int(mode) << " at length " << length << ": " << ranked.score << " then "
+                          << deferred.score << RESET << std::endl;
+                deferred_matches = false;
+            }
+        }
+    }
+    if (deferred_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: compute_cigar changed a score-only result" << RESET << std::endl << std::endl;
+    }
+
+    // Splitting a read into parallel gap and end-extension tasks must give the
+    // serial alignment back.
+    std::cout << YELLOW << "Test " << ++test_number << ": Split-read alignment" << RESET << std::endl;
+    WorkStealingPool split_pool(4);
+    bool split_matches = true;
+    for (size_t i = 0; i < batch_reads.size(); ++i) {
+        AlignmentResult split = align_split_read(batch_reads[i], {3, 2, default_scoring}, split_pool);
+        split_matches = split_matches && split.score == serial_results[i].score && split.query_start == serial_results[i].query_start &&
+                        split.ref_end == serial_results[i].ref_end && split.to_cigar_string() == serial_results[i].to_cigar_string();
+    }
+    PiecewiseParams split_params = {15, 10, default_scoring};
+    split_params.split_read_bases = 1;
+    std::vector<AlignmentResult> split_reseeded = align_batch({{reseed_query, reseed_reference, &reseed_anchors}}, split_params, split_pool);
+    split_matches = split_matches && split_reseeded[0].score == reseeded.score && split_reseeded[0].to_cigar_string() == reseeded.to_cigar_string();
+
+    // A read long enough for several spans, so span boundaries and the merging
+    // of their CIGARs are exercised: exact 40-base blocks carrying two anchors,
+    // separated by 20-base stretches with substitutions and small indels.
+    std::string long_reference = "GATTACAGATTACAGATTACAGATTACA";
+    std::string long_query = "GATTACACATTACAGATTAC";
+    std::vector<Anchor> long_anchors;
+    while (long_query.length() < 70000) {
+        std::string block;
+        for (size_t i = 0; i < 40; ++i) {
+            lcg = lcg * 1103515245 + 12345;
+            block += "ACGT"[(lcg >> 16) & 3];
+        }
+        long_anchors.push_back({uint(long_query.length()), uint(long_reference.length())});
+        long_anchors.push_back({uint(long_query.length() + 20), uint(long_reference.length() + 20)});
+        long_query += block;
+        long_reference += block;
+        std::string stretch;
+        for (size_t i = 0; i < 20; ++i) {
+            lcg = lcg * 1103515245 + 12345;
+            stretch += "ACGT"[(lcg >> 16) & 3];
+        }
+        long_reference += stretch;
+        lcg = lcg * 1103515245 + 12345;
+        stretch[(lcg >> 16) % 20] = 'A';
+        lcg = lcg * 1103515245 + 12345;
+        const size_t indel = (lcg >> 16) % 7;
+        if (indel < 3) {
+            stretch.insert(10, indel + 1, 'C');
+        } else if (indel < 6) {
+            stretch.erase(10, indel - 2);
+        }
+        long_query += stretch;
+    }
+    long_query += "TTAGGGTTAGGG";
+    long_reference += "TTAGGGTTAGGGTTAGGG";
+    const PiecewiseRead long_read = {long_query, long_reference, &long_anchors};
+    AlignmentResult long_serial = piecewise_extension_alignment(long_query, long_reference, long_anchors, 15, 10, default_scoring);
+    AlignmentResult long_split = align_split_read(long_read, split_params, split_pool);
+    std::cout << "Long read: " << long_query.length() << " bases, " << long_anchors.size() << " anchors" << std::endl;
+    split_matches = split_matches && long_query.length() >= 2 * kAlignBatchTaskBases && long_split.score == long_serial.score &&
+                    long_split.query_start == long_serial.query_start && long_split.query_end == long_serial.query_end &&
+                    long_split.ref_start == long_serial.ref_start && long_split.ref_end == long_serial.ref_end &&
+                    long_split.to_cigar_string() == long_serial.to_cigar_string() && validate_alignment(long_query, long_reference, long_split);
+    if (split_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Split-read alignments differ from serial results" << RESET << std::endl << std::endl;
+    }
+
+    // Items must all come through a pipeline with tiny queues, and an error in
+    // a stage must stop the pipeline and come out of wait().
+    std::cout << YELLOW << "Test " << ++test_number << ": Pipeline with bounded queues" << RESET << std::endl;
+    const auto run_pipeline = [](int fail_at) {
+        Pipeline pipeline;
+        auto& numbers = pipeline.queue<std::unique_ptr<int>>(1);
+        auto& doubled = pipeline.queue<std::unique_ptr<int>>(2);
+        int next = 0;
+        long sum = 0;
+        pipeline.source(numbers, [&](std::unique_ptr<int>& item) {
+            if (next == 10000) return false;
+            item = std::make_unique<int>(next++);
+            return true;
+        });
+        pipeline.stage(numbers, doubled, 3, [fail_at](std::unique_ptr<int> item) {
+            if (*item == fail_at) throw std::runtime_error("stage failed");
+            *item *= 2;
+            return item;
+        });
+        pipeline.sink(doubled, [&](std::unique_ptr<int> item) { sum += *item; });
+        pipeline.wait();
+        return sum;
+    };
+    bool pipeline_ok = run_pipeline(-1) == 99990000;
+    try {
+        run_pipeline(500);
+        pipeline_ok = false;
+    } catch (const std::runtime_error&) {
+    }
+    if (pipeline_ok) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Pipeline lost items or swallowed an error" << RESET << std::endl << std::endl;
+    }
+
+    // Aligning through cached reference windows and profiles must not change
+    // any alignment, and the second pass must hit the cache.
+    std::cout << YELLOW << "Test " << ++test_number << ": Reference window cache" << RESET << std::endl;
+    ReferenceWindowCache reference_cache;
+    AlignmentPolicy cached_policy;
+    cached_policy.reference_cache = &reference_cache;
+    BlockAlignerWorkspace cached_workspace;
+    cached_workspace.set_policy(cached_policy);
+    bool cache_matches = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const auto& test : test_cases) {
+            AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+            AlignmentResult cached = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring, cached_workspace);
+            if (cached.score != expected.score || cached.to_cigar_string() != expected.to_cigar_string()) {
+                std::cout << RED << "Mismatch on " << test.name << RESET << std::endl;
+                cache_matches = false;
+            }
+        }
+    }
+    // Windows known by their position hit even when their bases sit at another
+    // address, as when they are copied or unpacked into reused scratch.
+    size_t positioned_misses = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        const size_t misses_before = reference_cache.misses();
+        for (size_t t = 0; t < test_cases.size(); ++t) {
+            const TestCase& test = test_cases[t];
+            const std::string copied_reference = test.reference;
+            const PiecewiseRead read = {test.query, copied_reference, &test.anchors, false, t, 0};
+            AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+            AlignmentResult positioned;
+            piecewise_extension_alignment_batch(&read, 1, test.k, test.padding, default_scoring, cached_workspace, &positioned);
+            cache_matches = cache_matches && positioned.score == expected.score && positioned.to_cigar_string() == expected.to_cigar_string();
+        }
+        positioned_misses = reference_cache.misses() - misses_before;
+    }
+    cache_matches = cache_matches && positioned_misses == 0 && cached_workspace.reference_origins().empty();
+    std::cout << "Cache hits: " << reference_cache.hits() << ", misses: " << reference_cache.misses() << std::endl;
+    if (cache_matches && reference_cache.hits() >= reference_cache.misses()) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Cached alignments differ or the cache never hit" << RESET << std::endl << std::endl;
+    }
+
+    // Memoized gap alignments and end extensions must match fresh ones, both
+    // through the piecewise extension and through the batch kernel.
+    std::cout << YELLOW << "Test " << ++test_number << ": Gap alignment cache" << RESET << std::endl;
+    GapAlignmentCache alignment_cache;
+    AlignmentPolicy memo_policy;
+    memo_policy.alignment_cache = &alignment_cache;
+    BlockAlignerWorkspace memo_workspace;
+    memo_workspace.set_policy(memo_policy);
+    bool memo_matches = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const auto& test : test_cases) {
+            AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+            AlignmentResult memoized = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring, memo_workspace);
+            if (memoized.score != expected.score || memoized.to_cigar_string() != expected.to_cigar_string()) {
+                std::cout << RED << "Mismatch on " << test.name << RESET << std::endl;
+                memo_matches = false;
+            }
+        }
+    }
+    const std::string long_gap_query = std::string(100, 'A') + "C";
+    const std::string long_gap_ref = std::string(96, 'A') + "GC";
+    const std::vector<GapPair> repeated_gaps = {
+        {"ACGTACGTTGCAACGTAC", "ACGTCGTTGCAAACGTAC"}, {"TTTTTTTTTTTTTTTTTTTTTTTTTTTTTT", "TTTTTTTTTTTTTTTTTTTTTTTTTT"},
+        {"ACGTACGTTGCAACGTAC", "ACGTCGTTGCAAACGTAC"}, {long_gap_query, long_gap_ref},
+        {"TTTTTTTTTTTTTTTTTTTTTTTTTTTTTT", "TTTTTTTTTTTTTTTTTTTTTTTTTT"}, {long_gap_query, long_gap_ref}};
+    BatchAlignmentResult fresh_gaps;
+    BatchAlignmentResult memo_gaps;
+    BlockAlignerWorkspace fresh_workspace;
+    global_alignment_batch(repeated_gaps, default_scoring, fresh_workspace, fresh_gaps);
+    global_alignment_batch(repeated_gaps, default_scoring, memo_workspace, memo_gaps);
+    memo_matches = memo_matches && fresh_gaps.scores == memo_gaps.scores && fresh_gaps.cigar_offsets == memo_gaps.cigar_offsets;
+    for (size_t i = 0; memo_matches && i < fresh_gaps.cigar_ops.size(); ++i) {
+        memo_matches = fresh_gaps.cigar_ops[i].op == memo_gaps.cigar_ops[i].op && fresh_gaps.cigar_ops[i].len == memo_gaps.cigar_ops[i].len;
+    }
+    std::cout << "Cache hits: " << alignment_cache.hits() << ", misses: " << alignment_cache.misses() << std::endl;
+    if (memo_matches && alignment_cache.hits() > 0) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Memoized alignments differ or the cache never hit" << RESET << std::endl << std::endl;
+    }
+
+    // A minus-strand read handed over as sequenced must align exactly like its
+    // reverse complement, through the serial, packed and split paths, and its
+    // result must say so.
+    std::cout << YELLOW << "Test " << ++test_number << ": Reverse-complement reads" << RESET << std::endl;
+    const auto reverse_complement = [](std::string_view seq) {
+        std::string out(seq.length(), 'N');
+        ReverseComplementView(seq).copy(out.data());
+        return out;
+    };
+    BlockAlignerWorkspace strand_workspace;
+    bool strand_matches = true;
+    for (const auto& test : test_cases) {
+        const std::string sequenced = reverse_complement(test.query);
+        AlignmentResult expected = piecewise_extension_alignment(test.query, test.reference, test.anchors, test.k, test.padding, default_scoring);
+        PiecewiseRead minus_read = {sequenced, test.reference, &test.anchors, true};
+        AlignmentResult minus;
+        piecewise_extension_alignment_batch(&minus_read, 1, test.k, test.padding, default_scoring, strand_workspace, &minus);
+        PackedSequence packed_reference(test.reference);
+        PackedPiecewiseRead packed_read = {sequenced, &packed_reference, &test.anchors, true};
+        AlignmentResult packed;
+        piecewise_extension_alignment_batch(&packed_read, 1, test.k, test.padding, default_scoring, strand_workspace, &packed);
+        AlignmentResult split = align_split_read(minus_read, {test.k, test.padding, default_scoring}, split_pool);
+        for (const AlignmentResult* result : {&minus, &packed, &split}) {
+            if (result->score != expected.score || result->query_start != expected.query_start || result->ref_end != expected.ref_end ||
+                result->to_cigar_string() != expected.to_cigar_string() || !result->reverse_complement || expected.reverse_complement) {
+                std::cout << RED << "Mismatch on " << test.name << RESET << std::endl;
+                strand_matches = false;
+            }
+        }
+    }
+    const std::string reseed_sequenced = reverse_complement(reseed_query);
+    const PiecewiseRead minus_reseed_read = {reseed_sequenced, reseed_reference, &reseed_anchors, true};
+    std::vector<AlignmentResult> minus_reseeded = align_batch({minus_reseed_read}, split_params, split_pool);
+    piecewise_extension_alignment_batch(&minus_reseed_read, 1, 15, 10, default_scoring, strand_workspace, &minus_reseeded.emplace_back());
+    for (const AlignmentResult& result : minus_reseeded) {
+        strand_matches = strand_matches && result.score == reseeded.score && result.to_cigar_string() == reseeded.to_cigar_string() &&
+                         result.reverse_complement;
+    }
+    if (strand_matches) {
+        std::cout << GREEN << "✅ TEST PASSED" << RESET << std::endl << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << RED << "❌ TEST FAILED: Reverse-complement reads align differently from their forward copies" << RESET << std::endl << std::endl;
+    }
+
     std::cout << BLUE << "=== FINAL REPORT ===" << RESET << std::endl;
     std::cout << "Tests passed: " << GREEN << passed_tests << RESET << "/" << total_tests << std::endl;
     std::cout << "Tests failed: " << RED << (total_tests - passed_tests) << RESET << "/" << total_tests << std::endl;
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include "minimizer_index.hpp"
+
+namespace {
+
+constexpr char kIndexMagic[8] = {'P', 'W', 'M', 'I', 'D', 'X', '1', '\0'};
+constexpr size_t kBuildChunkBases = 1 << 22;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t k;
+    uint32_t w;
+    uint32_t bucket_bits;
+    uint32_t reserved;
+    uint64_t contig_count;
+    uint64_t entry_count;
+    uint64_t names_bytes;
+};
+
+uint8_t base_code(char c) {
+    switch (c) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return 4;
+    }
+}
+
+// Invertible integer mix within the 2k-bit k-mer space (as in minimap2), so
+// that minimizers are not biased towards poly-A k-mers.
+uint64_t hash_kmer(uint64_t key, uint64_t mask) {
+    key = (~key + (key << 21)) & mask;
+    key = key ^ key >> 24;
+    key = ((key + (key << 3)) + (key << 8)) & mask;
+    key = key ^ key >> 14;
+    key = ((key + (key << 2)) + (key << 4)) & mask;
+    key = key ^ key >> 28;
+    key = (key + (key << 31)) & mask;
+    return key;
+}
+
+size_t padded_size(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+}
+
+}
+
+void compute_minimizers(std::string_view seq, const MinimizerParams& params, size_t begin, size_t end, std::vector<Minimizer>& out) {
+    const size_t k = params.k;
+    if (seq.length() < k) return;
+    const size_t kmer_count = seq.length() - k + 1;
+    const size_t w = std::min<size_t>(params.w, kmer_count);
+    const size_t window_count = kmer_count - w + 1;
+    end = std::min(end, window_count);
+    if (begin >= end) return;
+
+    const uint64_t mask = k == 32 ? ~uint64_t(0) : (uint64_t(1) << (2 * k)) - 1;
+    const uint64_t invalid = ~uint64_t(0);
+    std::deque<Minimizer> window;
+    uint64_t kmer = 0;
+    size_t valid_bases = 0;
+    uint32_t last_pos = ~uint32_t(0);
+
+    // k-mers [begin, end + w - 1) cover every window starting in [begin, end).
+    for (size_t j = begin; j < end + w - 1 + k - 1; j++) {
+        uint8_t code = base_code(seq[j]);
+        if (code > 3) {
+            valid_bases = 0;
+        } else {
+            kmer = ((kmer << 2) | code) & mask;
+            valid_bases++;
+        }
+        if (j < begin + k - 1) continue;
+        const size_t i = j - k + 1;
+        uint64_t hash = valid_bases >= k ? hash_kmer(kmer, mask) : invalid;
+
+        while (!window.empty() && window.back().hash > hash) window.pop_back();
+        window.push_back({hash, static_cast<uint32_t>(i)});
+        while (window.front().pos + w <= i) window.pop_front();
+
+        if (i + 1 >= begin + w) {
+            const Minimizer& best = window.front();
+            if (best.hash != invalid && best.pos != last_pos) {
+                out.push_back(best);
+                last_pos = best.pos;
+            }
+        }
+    }
+}
+
+MinimizerIndex MinimizerIndex::build(const std::vector<Contig>& contigs, const MinimizerParams& params, WorkStealingPool& pool) {
+    std::vector<std::string> names;
+    std::vector<uint64_t> lengths;
+    for (const auto& contig : contigs) {
+        names.emplace_back(contig.name);
+        lengths.push_back(contig.sequence.length());
+    }
+    return build(std::move(names), std::move(lengths), [&contigs](uint32_t contig, size_t pos, size_t len, std::string&) {
+        return contigs[contig].sequence.substr(pos, len);
+    }, params, pool);
+}
+
+MinimizerIndex MinimizerIndex::build(const MappedReference& reference, const MinimizerParams& params, WorkStealingPool& pool) {
+    std::vector<std::string> names;
+    std::vector<uint64_t> lengths;
+    for (const auto& contig : reference.contigs()) {
+        names.emplace_back(contig.name);
+        lengths.push_back(contig.length);
+    }
+    return build(std::move(names), std::move(lengths), [&reference](uint32_t contig, size_t pos, size_t len, std::string& buffer) {
+        return reference.bases(reference.contigs()[contig], pos, len, buffer);
+    }, params, pool);
+}
+
+MinimizerIndex MinimizerIndex::build(std::vector<std::string> names, std::vector<uint64_t> lengths, const ContigBases& contig_bases,
+                                     const MinimizerParams& params, WorkStealingPool& pool) {
+    if (params.k < 1 || params.k > 32 || params.w < 1) {
+        throw std::invalid_argument("minimizer k must be in [1, 32] and w positive");
+    }
+    MinimizerIndex index;
+    index.params_ = params;
+    index.contig_names_ = std::move(names);
+    index.contig_lengths_ = std::move(lengths);
+
+    // Contigs are cut into chunks of windows that are processed independently.
+    struct Chunk {
+        uint32_t contig;
+        size_t begin;
+        size_t end;
+        std::vector<IndexEntry> entries;
+    };
+    std::vector<Chunk> chunks;
+    for (uint32_t c = 0; c < index.contig_lengths_.size(); c++) {
+        for (size_t begin = 0; begin < index.contig_lengths_[c]; begin += kBuildChunkBases) {
+            chunks.push_back({c, begin, begin + kBuildChunkBases, {}});
+        }
+    }
+
+    // A chunk reads the bases of its windows only. Past the first chunk of a
+    // contig, a chunk too short for one full window has no window to report,
+    // while compute_minimizers would shrink the window to fit.
+    const size_t window_bases = size_t(params.w) + params.k - 1;
+    TaskGroup group;
+    for (auto& chunk : chunks) {
+        pool.submit(group, [&chunk, &contig_bases, &params, window_bases](size_t) {
+            std::string buffer;
+            std::string_view bases = contig_bases(chunk.contig, chunk.begin, chunk.end - chunk.begin + window_bases - 1, buffer);
+            if (chunk.begin > 0 && bases.length() < window_bases) return;
+            std::vector<Minimizer> minimizers;
+            compute_minimizers(bases, params, 0, chunk.end - chunk.begin, minimizers);
+            chunk.entries.reserve(minimizers.size());
+            for (const auto& m : minimizers) {
+                chunk.entries.push_back({m.hash, chunk.contig, static_cast<uint32_t>(chunk.begin + m.pos)});
+            }
+        });
+    }
+    pool.wait(group);
+
+    // A minimizer at the edge of a chunk may be reported by both neighbours.
+    size_t total = 0;
+    for (const auto& chunk : chunks) total += chunk.entries.size();
+    std::vector<IndexEntry>& entries = index.owned_entries_;
+    entries.reserve(total);
+    for (auto& chunk : chunks) {
+        for (const auto& entry : chunk.entries) {
+            if (!entries.empty() && entries.back().contig == entry.contig && entries.back().pos >= entry.pos) continue;
+            entries.push_back(entry);
+        }
+        std::vector<IndexEntry>().swap(chunk.entries);
+    }
+
+    // Parallel sort: sort one slice per worker, then merge slices pairwise.
+    auto by_key = [](const IndexEntry& a, const IndexEntry& b) {
+        if (a.hash != b.hash) return a.hash < b.hash;
+        if (a.contig != b.contig) return a.contig < b.contig;
+        return a.pos < b.pos;
+    };
+    const size_t slices = std::max<size_t>(1, std::min(pool.size(), entries.size() / 4096 + 1));
+    std::vector<size_t> bounds(slices + 1);
+    for (size_t s = 0; s <= slices; s++) bounds[s] = entries.size() * s / slices;
+    for (size_t s = 0; s < slices; s++) {
+        pool.submit(group, [&entries, &bounds, &by_key, s](size_t) {
+            std::sort(entries.begin() + bounds[s], entries.begin() + bounds[s + 1], by_key);
+        });
+    }
+    pool.wait(group);
+    for (size_t width = 1; width < slices; width *= 2) {
+        for (size_t s = 0; s + width < slices; s += 2 * width) {
+            size_t last = std::min(s + 2 * width, slices);
+            pool.submit(group, [&entries, &bounds, &by_key, s, width, last](size_t) {
+                std::inplace_merge(entries.begin() + bounds[s], entries.begin() + bounds[s + width], entries.begin() + bounds[last], by_key);
+            });
+        }
+        pool.wait(group);
+    }
+
+    // About four entries per bucket, within the 2k bits a hash can use.
+    uint32_t bits = 1;
+    while (bits < 2u * params.k && bits < 30 && (size_t(1) << bits) * 4 < entries.size()) bits++;
+    index.bucket_bits_ = bits;
+    std::vector<uint64_t>& offsets = index.owned_offsets_;
+    offsets.assign((size_t(1) << bits) + 1, 0);
+    const uint32_t shift = 2 * params.k - bits;
+    for (const auto& entry : entries) offsets[(entry.hash >> shift) + 1]++;
+    for (size_t b = 1; b < offsets.size(); b++) offsets[b] += offsets[b - 1];
+
+    index.entry_count_ = entries.size();
+    index.entries_ = entries.data();
+    index.bucket_offsets_ = offsets.data();
+    return index;
+}
+
+void MinimizerIndex::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot open " + path + " for writing");
+    }
+    std::string names;
+    for (const auto& name : contig_names_) {
+        names += name;
+        names += '\0';
+    }
+    names.resize(padded_size(names.size()), '\0');
+
+    IndexHeader header = {};
+    std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.k = params_.k;
+    header.w = params_.w;
+    header.bucket_bits = bucket_bits_;
+    header.contig_count = contig_lengths_.size();
+    header.entry_count = entry_count_;
+    header.names_bytes = names.size();
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(contig_lengths_.data()), contig_lengths_.size() * sizeof(uint64_t));
+    out.write(names.data(), names.size());
+    out.write(reinterpret_cast<const char*>(bucket_offsets_), ((size_t(1) << bucket_bits_) + 1) * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(entries_), entry_count_ * sizeof(IndexEntry));
+    if (!out) {
+        throw std::runtime_error("failed writing " + path);
+    }
+}
+
+MinimizerIndex MinimizerIndex::load(const std::string& path) {
+    MinimizerIndex index;
+    index.file_ = MappedFile(path, MapAdvice::Random);
+    const char* data = index.file_.data();
+    const size_t size = index.file_.size();
+
+    IndexHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error(path + " is not a minimizer index");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+        throw std::runtime_error(path + " is not a minimizer index");
+    }
+    // Every count is checked against the bytes left before it is used, so no
+    // size computation below can overflow.
+    const std::string corrupt = path + " is truncated or corrupt";
+    if (header.k < 1 || header.k > 32 || static_cast<int>(header.w) < 1 || header.bucket_bits >= 64 || header.bucket_bits > 2 * header.k) {
+        throw std::runtime_error(corrupt);
+    }
+    const size_t bucket_count = size_t(1) << header.bucket_bits;
+    size_t left = size - sizeof(header);
+    if (header.contig_count > left / sizeof(uint64_t)) throw std::runtime_error(corrupt);
+    left -= header.contig_count * sizeof(uint64_t);
+    // save() pads the names so that the offsets and entries after them stay
+    // 8-byte aligned for the casts below.
+    if (header.names_bytes > left || header.names_bytes % sizeof(uint64_t) != 0) throw std::runtime_error(corrupt);
+    left -= header.names_bytes;
+    if (bucket_count >= left / sizeof(uint64_t)) throw std::runtime_error(corrupt);
+    left -= (bucket_count + 1) * sizeof(uint64_t);
+    if (left % sizeof(IndexEntry) != 0 || header.entry_count != left / sizeof(IndexEntry)) throw std::runtime_error(corrupt);
+    const size_t lengths_offset = sizeof(header);
+    const size_t names_offset = lengths_offset + header.contig_count * sizeof(uint64_t);
+    const size_t offsets_offset = names_offset + header.names_bytes;
+    const size_t entries_offset = offsets_offset + (bucket_count + 1) * sizeof(uint64_t);
+
+    index.params_ = {static_cast<int>(header.k), static_cast<int>(header.w)};
+    index.bucket_bits_ = header.bucket_bits;
+    index.entry_count_ = header.entry_count;
+    index.contig_lengths_.resize(header.contig_count);
+    std::memcpy(index.contig_lengths_.data(), data + lengths_offset, header.contig_count * sizeof(uint64_t));
+    const char* name = data + names_offset;
+    const char* names_end = name + header.names_bytes;
+    for (uint64_t c = 0; c < header.contig_count; c++) {
+        const char* name_end = static_cast<const char*>(std::memchr(name, '\0', names_end - name));
+        if (!name_end) throw std::runtime_error(corrupt);
+        index.contig_names_.emplace_back(name, name_end);
+        name = name_end + 1;
+    }
+    // Bucket offsets must rise from 0 to the entry count, or a lookup would
+    // leave the entries.
+    uint64_t previous = 0;
+    for (size_t b = 0; b <= bucket_count; b++) {
+        uint64_t offset;
+        std::memcpy(&offset, data + offsets_offset + b * sizeof(uint64_t), sizeof(offset));
+        if (offset < previous || (b == 0 && offset != 0) || offset > header.entry_count) throw std::runtime_error(corrupt);
+        previous = offset;
+    }
+    if (previous != header.entry_count) throw std::runtime_error(corrupt);
+    index.bucket_offsets_ = reinterpret_cast<const uint64_t*>(data + offsets_offset);
+    index.entries_ = reinterpret_cast<const IndexEntry*>(data + entries_offset);
+    return index;
+}
+
+const IndexEntry* MinimizerIndex::bucket_begin(uint64_t hash) const {
+    return entries_ + bucket_offsets_[hash >> (2 * params_.k - bucket_bits_)];
+}
+
+const IndexEntry* MinimizerIndex::bucket_end(uint64_t hash) const {
+    return entries_ + bucket_offsets_[(hash >> (2 * params_.k - bucket_bits_)) + 1];
+}
+
+void MinimizerIndex::find_anchors(std::string_view read, std::vector<ContigAnchors>& out, size_t max_occurrences) const {
+    out.clear();
+    std::vector<Minimizer> minimizers;
+    compute_minimizers(read, params_, 0, read.length(), minimizers);
+
+    std::unordered_map<uint32_t, size_t> slot_of_contig;
+    for (const auto& m : minimizers) {
+        auto range = std::equal_range(bucket_begin(m.hash), bucket_end(m.hash), IndexEntry{m.hash, 0, 0},
+                                      [](const IndexEntry& a, const IndexEntry& b) { return a.hash < b.hash; });
+        if (static_cast<size_t>(range.second - range.first) > max_occurrences) continue;
+        for (const IndexEntry* hit = range.first; hit != range.second; ++hit) {
+            if (hit->contig >= contig_count()) {
+                throw std::runtime_error("minimizer index is corrupt: entry for contig " + std::to_string(hit->contig) + " of " +
+                                         std::to_string(contig_count()));
+            }
+            auto [it, inserted] = slot_of_contig.try_emplace(hit->contig, out.size());
+            if (inserted) out.push_back({hit->contig, {}});
+            out[it->second].anchors.push_back({m.pos, hit->pos});
+        }
+    }
+}
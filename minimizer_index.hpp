@@ -0,0 +1,88 @@
+#ifndef MINIMIZER_INDEX_H
+#define MINIMIZER_INDEX_H
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "piecewise.hpp"
+#include "sequence_io.hpp"
+#include "thread_pool.hpp"
+
+struct MinimizerParams {
+    int k = 15;
+    int w = 10;
+};
+
+struct Minimizer {
+    uint64_t hash;
+    uint32_t pos;
+};
+
+// Appends the (w, k)-minimizers of `seq` to `out`, in position order. Only
+// windows whose first k-mer starts in [begin, end) are considered, which lets
+// callers split a long sequence into independent chunks. K-mers containing a
+// base other than A/C/G/T are skipped.
+void compute_minimizers(std::string_view seq, const MinimizerParams& params, size_t begin, size_t end, std::vector<Minimizer>& out);
+
+struct IndexEntry {
+    uint64_t hash;
+    uint32_t contig;
+    uint32_t pos;
+};
+
+struct ContigAnchors {
+    uint32_t contig;
+    std::vector<Anchor> anchors;
+};
+
+// Minimizer index of a reference: entries sorted by hash plus a table of
+// bucket offsets keyed by the top bits of the hash. The on-disk layout is the
+// in-memory layout, so load() maps the file and uses it in place.
+class MinimizerIndex {
+public:
+    static MinimizerIndex build(const std::vector<Contig>& contigs, const MinimizerParams& params, WorkStealingPool& pool);
+    // Reads the bases a chunk at a time, so wrapped contigs are never copied
+    // out whole.
+    static MinimizerIndex build(const MappedReference& reference, const MinimizerParams& params, WorkStealingPool& pool);
+    static MinimizerIndex load(const std::string& path);
+    void save(const std::string& path) const;
+
+    const MinimizerParams& params() const { return params_; }
+    size_t size() const { return entry_count_; }
+    size_t contig_count() const { return contig_lengths_.size(); }
+    const std::string& contig_name(uint32_t contig) const { return contig_names_[contig]; }
+    uint64_t contig_length(uint32_t contig) const { return contig_lengths_[contig]; }
+
+    // Anchors of `read` against every contig it hits, one group per contig.
+    // Minimizers occurring more than `max_occurrences` times in the reference
+    // are ignored as repeats. Anchors are in query order, ready for chaining.
+    void find_anchors(std::string_view read, std::vector<ContigAnchors>& out, size_t max_occurrences = 500) const;
+
+private:
+    // Bases [pos, pos + len) of a contig, clamped to its end, copied into
+    // `buffer` if they are not contiguous in memory.
+    using ContigBases = std::function<std::string_view(uint32_t contig, size_t pos, size_t len, std::string& buffer)>;
+
+    static MinimizerIndex build(std::vector<std::string> names, std::vector<uint64_t> lengths, const ContigBases& contig_bases,
+                                const MinimizerParams& params, WorkStealingPool& pool);
+    const IndexEntry* bucket_begin(uint64_t hash) const;
+    const IndexEntry* bucket_end(uint64_t hash) const;
+
+    MinimizerParams params_;
+    uint32_t bucket_bits_ = 0;
+    size_t entry_count_ = 0;
+    const IndexEntry* entries_ = nullptr;
+    const uint64_t* bucket_offsets_ = nullptr;
+    std::vector<std::string> contig_names_;
+    std::vector<uint64_t> contig_lengths_;
+
+    // Backing storage of entries_ and bucket_offsets_: owned vectors after
+    // build(), the file mapping after load().
+    std::vector<IndexEntry> owned_entries_;
+    std::vector<uint64_t> owned_offsets_;
+    MappedFile file_;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "format.hpp"
+#include "output_writer.hpp"
+#include "sequence_view.hpp"
+
+namespace {
+
+struct CigarCounts {
+    uint64_t matches = 0;
+    uint64_t edit_distance = 0;
+    uint64_t block_length = 0;
+};
+
+CigarCounts count_cigar(const std::vector<OpLen>& cigar) {
+    CigarCounts counts;
+    for (const auto& elem : cigar) {
+        if (elem.op == kSoftClip) continue;
+        switch (elem.op) {
+            case Operation::Eq:
+                counts.matches += elem.len;
+                break;
+            case Operation::X:
+            case Operation::I:
+            case Operation::D:
+                counts.edit_distance += elem.len;
+                break;
+            case Operation::M:
+            case Operation::Sentinel:
+                break;
+        }
+        if (elem.op != Operation::Sentinel) counts.block_length += elem.len;
+    }
+    return counts;
+}
+
+// The ops between the soft clips of a local-mode CIGAR, i.e. the part covering
+// [query_start, query_end).
+void aligned_ops(const std::vector<OpLen>& cigar, const OpLen*& begin, const OpLen*& end) {
+    begin = cigar.data();
+    end = cigar.data() + cigar.size();
+    if (begin != end && begin->op == kSoftClip) ++begin;
+    if (begin != end && end[-1].op == kSoftClip) --end;
+}
+
+}
+
+OutputSink::OutputSink(const std::string& path) {
+    fd_ = path == "-" ? STDOUT_FILENO : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+}
+
+OutputSink::~OutputSink() {
+    if (fd_ > STDERR_FILENO) close(fd_);
+}
+
+void OutputSink::write(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+AlignmentWriter::AlignmentWriter(OutputSink& sink, OutputFormat format, size_t flush_bytes)
+    : sink_(sink), format_(format), flush_bytes_(flush_bytes) {
+    buffer_.reserve(flush_bytes_ + (1 << 16));
+}
+
+AlignmentWriter::~AlignmentWriter() {
+    try {
+        flush();
+    } catch (...) {
+    }
+}
+
+void AlignmentWriter::flush() {
+    if (!buffer_.empty()) {
+        sink_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
+}
+
+void AlignmentWriter::write_header(const std::vector<MappedContig>& contigs) {
+    if (format_ != OutputFormat::Sam) return;
+    buffer_ += "@HD\tVN:1.6\tSO:unsorted\n";
+    for (const auto& contig : contigs) {
+        buffer_ += "@SQ\tSN:";
+        buffer_ += contig.name;
+        buffer_ += "\tLN:";
+        append_uint(buffer_, contig.length);
+        buffer_ += '\n';
+    }
+    buffer_ += "@PG\tID:piecewise\tPN:piecewise\n";
+}
+
+void AlignmentWriter::write(std::string_view name, std::string_view sequence, std::string_view quality,
+                            const MappedContig* contig, const AlignmentResult* result) {
+    if (format_ == OutputFormat::Sam) {
+        write_sam(name, sequence, quality, contig, result);
+    } else {
+        write_paf(name, sequence, contig, result);
+    }
+    if (buffer_.size() >= flush_bytes_) flush();
+}
+
+void AlignmentWriter::write_sam(std::string_view name, std::string_view sequence, std::string_view quality,
+                                const MappedContig* contig, const AlignmentResult* result) {
+    const bool reverse = result && contig && result->reverse_complement;
+    buffer_ += name;
+    if (!result || !contig) {
+        buffer_ += "\t4\t*\t0\t0\t*\t*\t0\t0\t";
+    } else {
+        buffer_ += reverse ? "\t16\t" : "\t0\t";
+        buffer_ += contig->name;
+        buffer_ += '\t';
+        append_uint(buffer_, result->ref_start + 1);
+        buffer_ += "\t255\t";
+        // SAM needs the CIGAR to cover the whole read, so the unaligned ends
+        // become soft clips, whether or not the CIGAR already carries them.
+        if (result->query_start > 0) {
+            append_uint(buffer_, result->query_start);
+            buffer_ += 'S';
+        }
+        const OpLen* begin;
+        const OpLen* end;
+        aligned_ops(result->cigar, begin, end);
+        append_cigar_string(buffer_, begin, end);
+        if (result->query_end < sequence.length()) {
+            append_uint(buffer_, sequence.length() - result->query_end);
+            buffer_ += 'S';
+        }
+        buffer_ += "\t*\t0\t0\t";
+    }
+    // A minus-strand record holds the read as aligned: SEQ reverse
+    // complemented and QUAL reversed.
+    if (reverse) {
+        const size_t offset = buffer_.size();
+        buffer_.resize(offset + sequence.length());
+        ReverseComplementView(sequence).copy(buffer_.data() + offset);
+    } else {
+        buffer_ += sequence;
+    }
+    buffer_ += '\t';
+    if (quality.empty()) {
+        buffer_ += '*';
+    } else if (reverse) {
+        buffer_.append(quality.rbegin(), quality.rend());
+    } else {
+        buffer_ += quality;
+    }
+    if (result && contig) {
+        buffer_ += "\tAS:i:";
+        append_int(buffer_, result->score);
+        buffer_ += "\tNM:i:";
+        append_uint(buffer_, count_cigar(result->cigar).edit_distance);
+    }
+    buffer_ += '\n';
+}
+
+void AlignmentWriter::write_paf(std::string_view name, std::string_view sequence, const MappedContig* contig, const AlignmentResult* result) {
+    // PAF has no record for unmapped reads.
+    if (!result || !contig) return;
+    CigarCounts counts = count_cigar(result->cigar);
+    buffer_ += name;
+    buffer_ += '\t';
+    append_uint(buffer_, sequence.length());
+    buffer_ += '\t';
+    // PAF query coordinates are on the read as given, whatever the strand.
+    if (result->reverse_complement) {
+        append_uint(buffer_, sequence.length() - result->query_end);
+        buffer_ += '\t';
+        append_uint(buffer_, sequence.length() - result->query_start);
+        buffer_ += "\t-\t";
+    } else {
+        append_uint(buffer_, result->query_start);
+        buffer_ += '\t';
+        append_uint(buffer_, result->query_end);
+        buffer_ += "\t+\t";
+    }
+    buffer_ += contig->name;
+    buffer_ += '\t';
+    append_uint(buffer_, contig->length);
+    buffer_ += '\t';
+    append_uint(buffer_, result->ref_start);
+    buffer_ += '\t';
+    append_uint(buffer_, result->ref_end);
+    buffer_ += '\t';
+    append_uint(buffer_, counts.matches);
+    buffer_ += '\t';
+    append_uint(buffer_, counts.block_length);
+    buffer_ += "\t255\ttp:A:P\tAS:i:";
+    append_int(buffer_, result->score);
+    buffer_ += "\tNM:i:";
+    append_uint(buffer_, counts.edit_distance);
+    buffer_ += "\tcg:Z:";
+    const OpLen* begin;
+    const OpLen* end;
+    aligned_ops(result->cigar, begin, end);
+    append_cigar_string(buffer_, begin, end);
+    buffer_ += '\n';
+}
@@ -0,0 +1,61 @@
+#ifndef ALIGNMENT_OUTPUT_WRITER_H
+#define ALIGNMENT_OUTPUT_WRITER_H
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "baligner.hpp"
+#include "sequence_io.hpp"
+
+enum class OutputFormat {
+    Sam,
+    Paf
+};
+
+// Output file shared by all writers. Writers hand it whole chunks, so the lock
+// is taken once per flush rather than once per record.
+class OutputSink {
+public:
+    explicit OutputSink(const std::string& path);
+    ~OutputSink();
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(const char* data, size_t len);
+
+private:
+    int fd_ = -1;
+    std::mutex mutex_;
+};
+
+// Formats SAM or PAF records into a reusable byte buffer and flushes it to the
+// sink in large chunks. Use one writer per thread; records of one writer stay
+// in order, while chunks of different writers interleave.
+class AlignmentWriter {
+public:
+    AlignmentWriter(OutputSink& sink, OutputFormat format, size_t flush_bytes = 4 << 20);
+    ~AlignmentWriter();
+    AlignmentWriter(const AlignmentWriter&) = delete;
+    AlignmentWriter& operator=(const AlignmentWriter&) = delete;
+
+    void write_header(const std::vector<MappedContig>& contigs);
+
+    // `result` is null for an unmapped read. `quality` may be empty (FASTA).
+    void write(std::string_view name, std::string_view sequence, std::string_view quality,
+               const MappedContig* contig, const AlignmentResult* result);
+
+    void flush();
+
+private:
+    void write_sam(std::string_view name, std::string_view sequence, std::string_view quality,
+                   const MappedContig* contig, const AlignmentResult* result);
+    void write_paf(std::string_view name, std::string_view sequence, const MappedContig* contig, const AlignmentResult* result);
+
+    OutputSink& sink_;
+    OutputFormat format_;
+    size_t flush_bytes_;
+    std::string buffer_;
+};
+
+#endif
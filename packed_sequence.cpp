@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <array>
+#include "packed_sequence.hpp"
+
+namespace {
+
+constexpr uint8_t kInvalidBase = 4;
+constexpr char kBaseChars[4] = {'A', 'C', 'G', 'T'};
+
+constexpr std::array<uint8_t, 256> make_base_codes() {
+    std::array<uint8_t, 256> codes = {};
+    for (auto& code : codes) code = kInvalidBase;
+    codes['A'] = codes['a'] = 0;
+    codes['C'] = codes['c'] = 1;
+    codes['G'] = codes['g'] = 2;
+    codes['T'] = codes['t'] = 3;
+    return codes;
+}
+
+constexpr std::array<uint8_t, 256> kBaseCodes = make_base_codes();
+
+uint8_t base_code(char c) {
+    return kBaseCodes[static_cast<unsigned char>(c)];
+}
+
+}
+
+PackedSequence::PackedSequence(std::string_view seq) : length_(seq.length()), words_((seq.length() + 31) / 32, 0) {
+    for (size_t i = 0; i < seq.length(); i++) {
+        uint8_t code = base_code(seq[i]);
+        if (code == kInvalidBase) {
+            if (!n_runs_.empty() && n_runs_.back().end == i) {
+                n_runs_.back().end++;
+            } else {
+                n_runs_.push_back({i, i + 1});
+            }
+            continue;
+        }
+        words_[i / 32] |= uint64_t(code) << (2 * (i % 32));
+    }
+}
+
+// The 32 bases starting at `pos`, first base in the low bits. Bases past the
+// end read as A.
+uint64_t PackedSequence::bits_at(size_t pos) const {
+    const size_t word = pos / 32;
+    const unsigned shift = 2 * (pos % 32);
+    uint64_t bits = words_[word] >> shift;
+    if (shift && word + 1 < words_.size()) bits |= words_[word + 1] << (64 - shift);
+    return bits;
+}
+
+bool PackedSequence::overlaps_n(size_t pos, size_t len) const {
+    auto run = std::upper_bound(n_runs_.begin(), n_runs_.end(), pos, [](size_t p, const NRun& r) { return p < r.end; });
+    return len > 0 && run != n_runs_.end() && run->begin < pos + len;
+}
+
+char PackedSequence::base(size_t pos) const {
+    if (overlaps_n(pos, 1)) return 'N';
+    return kBaseChars[(words_[pos / 32] >> (2 * (pos % 32))) & 3];
+}
+
+void PackedSequence::unpack(size_t pos, size_t len, char* out) const {
+    for (size_t done = 0; done < len; done += 32) {
+        uint64_t bits = bits_at(pos + done);
+        const size_t n = std::min<size_t>(32, len - done);
+        for (size_t i = 0; i < n; i++) {
+            out[done + i] = kBaseChars[bits & 3];
+            bits >>= 2;
+        }
+    }
+    auto run = std::upper_bound(n_runs_.begin(), n_runs_.end(), pos, [](size_t p, const NRun& r) { return p < r.end; });
+    for (; run != n_runs_.end() && run->begin < pos + len; ++run) {
+        const size_t begin = std::max<size_t>(run->begin, pos);
+        const size_t end = std::min<size_t>(run->end, pos + len);
+        std::fill(out + (begin - pos), out + (end - pos), 'N');
+    }
+}
+
+std::string PackedSequence::unpack(size_t pos, size_t len) const {
+    std::string out(len, '\0');
+    unpack(pos, len, out.data());
+    return out;
+}
+
+bool PackedSequence::matches(size_t pos, std::string_view kmer) const {
+    if (pos + kmer.length() > length_ || overlaps_n(pos, kmer.length())) return false;
+    for (size_t done = 0; done < kmer.length(); done += 32) {
+        const size_t n = std::min<size_t>(32, kmer.length() - done);
+        uint64_t packed = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t code = base_code(kmer[done + i]);
+            if (code == kInvalidBase) return false;
+            packed |= uint64_t(code) << (2 * i);
+        }
+        const uint64_t mask = n == 32 ? ~uint64_t(0) : (uint64_t(1) << (2 * n)) - 1;
+        if ((bits_at(pos + done) & mask) != packed) return false;
+    }
+    return true;
+}
+
+PackedReference::PackedReference(const std::vector<Contig>& contigs) {
+    contigs_.reserve(contigs.size());
+    for (const auto& contig : contigs) {
+        contigs_.push_back({std::string(contig.name), PackedSequence(contig.sequence)});
+    }
+}
+
+const PackedContig* PackedReference::find(std::string_view name) const {
+    for (const auto& contig : contigs_) {
+        if (contig.name == name) return &contig;
+    }
+    return nullptr;
+}
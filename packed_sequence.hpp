@@ -0,0 +1,64 @@
+#ifndef PACKED_SEQUENCE_H
+#define PACKED_SEQUENCE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "sequence_io.hpp"
+
+// Nucleotide sequence stored at 2 bits per base, 32 bases per word. Bases
+// other than A/C/G/T are kept in a side table of N runs and read back as 'N';
+// lowercase (soft-masked) bases are read back in uppercase.
+class PackedSequence {
+public:
+    PackedSequence() = default;
+    explicit PackedSequence(std::string_view seq);
+
+    size_t length() const { return length_; }
+    size_t memory_bytes() const { return words_.size() * sizeof(uint64_t) + n_runs_.size() * sizeof(NRun); }
+
+    char base(size_t pos) const;
+
+    // Writes bases [pos, pos + len) to `out` as ASCII.
+    void unpack(size_t pos, size_t len, char* out) const;
+    std::string unpack(size_t pos, size_t len) const;
+
+    // True if `kmer` equals the bases at `pos`, compared 32 bases at a time
+    // on the packed words. A k-mer never matches across an N.
+    bool matches(size_t pos, std::string_view kmer) const;
+
+private:
+    struct NRun {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    uint64_t bits_at(size_t pos) const;
+    bool overlaps_n(size_t pos, size_t len) const;
+
+    size_t length_ = 0;
+    std::vector<uint64_t> words_;
+    std::vector<NRun> n_runs_;
+};
+
+struct PackedContig {
+    std::string name;
+    PackedSequence sequence;
+};
+
+// A whole reference packed contig by contig, about a quarter of the size of
+// the FASTA it was built from.
+class PackedReference {
+public:
+    PackedReference() = default;
+    explicit PackedReference(const std::vector<Contig>& contigs);
+
+    const std::vector<PackedContig>& contigs() const { return contigs_; }
+    const PackedContig* find(std::string_view name) const;
+
+private:
+    std::vector<PackedContig> contigs_;
+};
+
+#endif
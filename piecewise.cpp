@@ -0,0 +1,804 @@
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "alignment_stats.hpp"
+#include "baligner.hpp"
+#include "chaining.hpp"
+#include "minimizer_index.hpp"
+#include "piecewise.hpp"
+#include "sequence_view.hpp"
+
+std::vector<OpLen> merge_cigar_elements(const std::vector<OpLen>& elements) {
+    if (elements.empty()) {
+        return {};
+    }
+    std::vector<OpLen> merged_elements;
+    merged_elements.push_back(elements[0]);
+    for (size_t i = 1; i < elements.size(); ++i) {
+        if (elements[i].op == merged_elements.back().op) {
+            merged_elements.back().len += elements[i].len;
+        } else {
+            merged_elements.push_back(elements[i]);
+        }
+    }
+    return merged_elements;
+}
+
+namespace {
+
+// Query bases [pos, pos + len) on the strand being aligned. The bases of a
+// reverse-complement read are complemented into `scratch`, after what it
+// already holds, and the view points there; the caller keeps `scratch` from
+// reallocating while earlier views are in use.
+std::string_view slice_query(const PiecewiseRead& read, size_t pos, size_t len, std::string& scratch) {
+    if (!read.reverse_complement) return read.query.substr(pos, len);
+    const ReverseComplementView bases = ReverseComplementView(read.query).substr(pos, len);
+    const size_t offset = scratch.size();
+    scratch.resize(offset + bases.length());
+    bases.copy(scratch.data() + offset);
+    return std::string_view(scratch).substr(offset);
+}
+
+// Local-mode end extension. It first covers only the max_block_size query
+// bases next to the anchors and doubles the window only while the alignment
+// runs into the window's far edge, so a long adapter or chimeric tail costs one
+// x-drop-terminated block instead of a DP over the whole tail. Coordinates are
+// relative to query_part and ref_part, as for the plain extensions.
+template <AlignmentMode Mode>
+AlignmentResult local_end_extension(
+    std::string_view query_part,
+    std::string_view ref_part,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    CigarBuilder& cigar
+) {
+    constexpr bool backwards = Mode == AlignmentMode::FreeQueryStart;
+    size_t window = std::min<size_t>(query_part.length(), workspace.policy().max_block_size);
+    while (true) {
+        const size_t ref_window = std::min(ref_part.length(), window + padding);
+        const size_t query_offset = backwards ? query_part.length() - window : 0;
+        const size_t ref_offset = backwards ? ref_part.length() - ref_window : 0;
+        std::string_view query_sub = query_part.substr(query_offset, window);
+        std::string_view ref_sub = ref_part.substr(ref_offset, ref_window);
+
+        const CigarBuilder::Checkpoint before = cigar.checkpoint();
+        AlignmentResult aligned;
+        bool at_edge;
+        if constexpr (backwards) {
+            aligned = free_query_start_alignment(query_sub, ref_sub, scoring_params, workspace, cigar);
+            at_edge = aligned.query_start == 0 || (aligned.ref_start == 0 && ref_offset > 0);
+        } else {
+            aligned = free_query_end_alignment(query_sub, ref_sub, scoring_params, workspace, cigar);
+            at_edge = aligned.query_end == window || (aligned.ref_end == ref_window && ref_window < ref_part.length());
+        }
+        if (!at_edge || window == query_part.length()) {
+            aligned.query_start += query_offset;
+            aligned.query_end += query_offset;
+            aligned.ref_start += ref_offset;
+            aligned.ref_end += ref_offset;
+            return aligned;
+        }
+        cigar.rollback(before);
+        window = std::min(query_part.length(), 2 * window);
+    }
+}
+
+// Aligns the query before the first segment into `cigar` and sets the start
+// of `result`. An extension that scores 0 is dropped.
+template <typename Scoring>
+void extend_prefix(
+    const PiecewiseRead& read,
+    const AnchorSegment& first_segment,
+    const int padding,
+    const Scoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    CigarBuilder& cigar,
+    AlignmentResult& result
+) {
+    result.query_start = first_segment.query_start;
+    result.ref_start = first_segment.ref_start;
+    if (first_segment.query_start == 0 || first_segment.ref_start == 0) return;
+
+    workspace.strand_scratch().clear();
+    std::string_view query_part = slice_query(read, 0, first_segment.query_start, workspace.strand_scratch());
+    const size_t ref_start = std::max(0, static_cast<int>(first_segment.ref_start) - (static_cast<int>(query_part.length()) + padding));
+    std::string_view ref_part = read.reference.substr(ref_start, first_segment.ref_start - ref_start);
+    PIECEWISE_STAT_SCOPE(AlignmentStage::Prefix, uint64_t(query_part.length()) * ref_part.length());
+
+    const CigarBuilder::Checkpoint before_prefix = cigar.checkpoint();
+    AlignmentResult pre_align = workspace.policy().soft_clip
+        ? local_end_extension<AlignmentMode::FreeQueryStart>(query_part, ref_part, padding, scoring_params, workspace, cigar)
+        : free_query_start_alignment(query_part, ref_part, scoring_params, workspace, cigar);
+
+    if (pre_align.score == 0) {
+        cigar.rollback(before_prefix);
+    } else {
+        result.score += pre_align.score;
+        result.query_start = pre_align.query_start;
+        result.ref_start = ref_start + pre_align.ref_start;
+    }
+}
+
+// Appends every segment after the first, each preceded by the gap before it,
+// to `cigar`: `gaps` holds the gap results in segment order starting at
+// `first_gap`.
+template <typename Scoring>
+void stitch_segments(
+    const AnchorSegment* segments,
+    size_t segment_count,
+    const Scoring& scoring_params,
+    const BatchAlignmentResult& gaps,
+    size_t first_gap,
+    CigarBuilder& cigar,
+    AlignmentResult& result
+) {
+    size_t gap_index = first_gap;
+    for (size_t i = 1; i < segment_count; ++i) {
+        const AnchorSegment& segment = segments[i];
+        const AnchorSegment& prev_segment = segments[i - 1];
+        const int length = segment.length;
+
+        int curr_start_query = segment.query_start;
+        int curr_start_ref = segment.ref_start;
+        int prev_end_query = prev_segment.query_start + prev_segment.length;
+        int prev_end_ref = prev_segment.ref_start + prev_segment.length;
+
+        int ref_diff = curr_start_ref - prev_end_ref;
+        int query_diff = curr_start_query - prev_end_query;
+
+        if (ref_diff > 0 && query_diff > 0){
+            result.score += gaps.scores[gap_index];
+            cigar.append(gaps.cigar_begin(gap_index), gaps.cigar_end(gap_index));
+            gap_index++;
+
+            result.score += length * scoring_params.match;
+            cigar.push(Operation::Eq, length);
+        } else {
+            PIECEWISE_STAT_SCOPE(AlignmentStage::IndelShortcut, 0);
+             if (ref_diff < query_diff) {
+                const size_t inserted_part = -ref_diff + query_diff;
+                result.score += scoring_params.gap_open + (inserted_part - 1) * scoring_params.gap_extend;
+                cigar.push(Operation::I, inserted_part);
+
+                const size_t matching_part = length + ref_diff;
+                result.score += matching_part * scoring_params.match;
+                cigar.push(Operation::Eq, matching_part);
+            } else if (ref_diff > query_diff) {
+                const size_t deleted_part = -query_diff + ref_diff;
+                result.score += scoring_params.gap_open + (deleted_part - 1) * scoring_params.gap_extend;
+                cigar.push(Operation::D, deleted_part);
+
+                const size_t matching_part = length + query_diff;
+                result.score += matching_part * scoring_params.match;
+                cigar.push(Operation::Eq, matching_part);
+            } else {
+                const size_t matching_part = length + ref_diff;
+                result.score += matching_part * scoring_params.match;
+                cigar.push(Operation::Eq, matching_part);
+            }
+        }
+    }
+}
+
+// Aligns the query after the last segment into `cigar` and sets the end of
+// `result`. An extension that scores 0 is dropped.
+template <typename Scoring>
+void extend_suffix(
+    const PiecewiseRead& read,
+    const AnchorSegment& last_segment,
+    const int padding,
+    const Scoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    CigarBuilder& cigar,
+    AlignmentResult& result
+) {
+    std::string_view query = read.query;
+    std::string_view reference = read.reference;
+    const size_t last_anchor_end_query = last_segment.query_start + last_segment.length;
+    const size_t last_anchor_end_ref = last_segment.ref_start + last_segment.length;
+    result.query_end = last_anchor_end_query;
+    result.ref_end = last_anchor_end_ref;
+    if (last_anchor_end_query >= query.length() || last_anchor_end_ref >= reference.length()) return;
+
+    workspace.strand_scratch().clear();
+    std::string_view query_part = slice_query(read, last_anchor_end_query, query.length() - last_anchor_end_query, workspace.strand_scratch());
+    const size_t ref_part_end = std::min(reference.length(), last_anchor_end_ref + query_part.length() + padding);
+    std::string_view ref_part = reference.substr(last_anchor_end_ref, ref_part_end - last_anchor_end_ref);
+    PIECEWISE_STAT_SCOPE(AlignmentStage::Suffix, uint64_t(query_part.length()) * ref_part.length());
+
+    const CigarBuilder::Checkpoint before_suffix = cigar.checkpoint();
+    AlignmentResult post_align = workspace.policy().soft_clip
+        ? local_end_extension<AlignmentMode::FreeQueryEnd>(query_part, ref_part, padding, scoring_params, workspace, cigar)
+        : free_query_end_alignment(query_part, ref_part, scoring_params, workspace, cigar);
+
+    if (post_align.score == 0) {
+        cigar.rollback(before_suffix);
+    } else {
+        result.score += post_align.score;
+        result.query_end = last_anchor_end_query + post_align.query_end;
+        result.ref_end = last_anchor_end_ref + post_align.ref_end;
+    }
+}
+
+// Moves the assembled CIGAR into `result`, adding the soft clips of local mode.
+void finish_cigar(const PiecewiseRead& read, bool soft_clip, CigarBuilder& cigar, AlignmentResult& result) {
+    if (soft_clip && result.query_end < read.query.length()) {
+        cigar.push(kSoftClip, read.query.length() - result.query_end);
+    }
+    if (soft_clip && result.query_start > 0) {
+        result.cigar.reserve(cigar.size() + 1);
+        result.cigar.push_back({kSoftClip, result.query_start});
+    }
+    result.cigar.insert(result.cigar.end(), cigar.begin(), cigar.end());
+}
+
+// Builds the alignment of one read once its inner gaps are aligned: `gaps`
+// holds their results in segment order starting at `first_gap`.
+template <typename Scoring>
+AlignmentResult assemble_piecewise_alignment(
+    const PiecewiseRead& read,
+    const AnchorSegment* segments,
+    size_t segment_count,
+    const int padding,
+    const Scoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    const BatchAlignmentResult& gaps,
+    size_t first_gap
+) {
+    AlignmentResult result;
+    result.score = 0;
+    result.reverse_complement = read.reverse_complement;
+    CigarBuilder& cigar = workspace.cigar_builder();
+    cigar.clear();
+    extend_prefix(read, segments[0], padding, scoring_params, workspace, cigar, result);
+    result.score += segments[0].length * scoring_params.match;
+    cigar.push(Operation::Eq, segments[0].length);
+    stitch_segments(segments, segment_count, scoring_params, gaps, first_gap, cigar, result);
+    extend_suffix(read, segments[segment_count - 1], padding, scoring_params, workspace, cigar, result);
+    finish_cigar(read, workspace.policy().soft_clip, cigar, result);
+    return result;
+}
+
+// Gap queries of a reverse-complement read go to `strand_bases`, which must
+// have room for them all.
+void collect_inner_gaps(const PiecewiseRead& read, const AnchorSegment* segments, size_t segment_count, std::vector<GapPair>& gaps,
+                        std::string& strand_bases) {
+    for (size_t i = 1; i < segment_count; ++i) {
+        int prev_end_query = segments[i - 1].query_start + segments[i - 1].length;
+        int prev_end_ref = segments[i - 1].ref_start + segments[i - 1].length;
+        int query_diff = static_cast<int>(segments[i].query_start) - prev_end_query;
+        int ref_diff = static_cast<int>(segments[i].ref_start) - prev_end_ref;
+        if (ref_diff > 0 && query_diff > 0) {
+            PIECEWISE_STAT_GAP(query_diff, ref_diff);
+            gaps.push_back({slice_query(read, prev_end_query, query_diff, strand_bases), read.reference.substr(prev_end_ref, ref_diff)});
+        }
+    }
+}
+
+}
+
+void coalesce_anchors(const std::vector<Anchor>& anchors, const int k, std::vector<AnchorSegment>& segments) {
+    // Segments already in `segments` belong to other reads of a batch.
+    const size_t first = segments.size();
+    for (const Anchor& anchor : anchors) {
+        if (segments.size() > first) {
+            AnchorSegment& last = segments.back();
+            const uint last_end_query = last.query_start + last.length;
+            if (anchor.query_start <= last_end_query && anchor.query_start >= last.query_start &&
+                anchor.ref_start - anchor.query_start == last.ref_start - last.query_start) {
+                last.length = std::max(last.length, anchor.query_start + k - last.query_start);
+                continue;
+            }
+        }
+        segments.push_back({anchor.query_start, anchor.ref_start, static_cast<uint>(k)});
+    }
+}
+
+namespace {
+
+// Re-seeding stops at this k; shorter k-mers hit too often by chance.
+constexpr int kMinReseedK = 7;
+// K-mers occurring more often than this within one gap are skipped as repeats.
+constexpr size_t kReseedMaxOccurrences = 8;
+
+// Seeds the gap query[query_begin, query_end) x reference[ref_begin, ref_end)
+// with every k-mer, chains the hits and appends the chained segments to `out`.
+// The pieces between them are re-seeded with k - 2 while they are still longer
+// than policy.reseed_gap; whatever is left is aligned by the DP as usual.
+void reseed_gap(const PiecewiseRead& read, uint query_begin, uint ref_begin, uint query_end, uint ref_end, int k,
+                const AlignmentPolicy& policy, std::string& strand_scratch, std::vector<AnchorSegment>& out) {
+    if (query_end <= query_begin || ref_end <= ref_begin || k < kMinReseedK) return;
+    const size_t query_len = query_end - query_begin;
+    const size_t ref_len = ref_end - ref_begin;
+    if (std::max(query_len, ref_len) <= policy.reseed_gap) return;
+
+    std::vector<AnchorSegment> found;
+    {
+        PIECEWISE_STAT_SCOPE(AlignmentStage::Reseed, uint64_t(query_len) + ref_len);
+        const MinimizerParams seed_params = {k, 1};
+        std::vector<Minimizer> query_seeds;
+        std::vector<Minimizer> ref_seeds;
+        strand_scratch.clear();
+        compute_minimizers(slice_query(read, query_begin, query_len, strand_scratch), seed_params, 0, query_len, query_seeds);
+        compute_minimizers(read.reference.substr(ref_begin, ref_len), seed_params, 0, ref_len, ref_seeds);
+        std::sort(ref_seeds.begin(), ref_seeds.end(), [](const Minimizer& a, const Minimizer& b) {
+            return a.hash != b.hash ? a.hash < b.hash : a.pos < b.pos;
+        });
+
+        std::vector<Anchor> anchors;
+        for (const Minimizer& seed : query_seeds) {
+            auto hits = std::equal_range(ref_seeds.begin(), ref_seeds.end(), seed, [](const Minimizer& a, const Minimizer& b) {
+                return a.hash < b.hash;
+            });
+            if (static_cast<size_t>(hits.second - hits.first) > kReseedMaxOccurrences) continue;
+            for (auto hit = hits.first; hit != hits.second; ++hit) {
+                anchors.push_back({query_begin + seed.pos, ref_begin + hit->pos});
+            }
+        }
+
+        // A lone chance hit must not become a segment, so a chain needs at
+        // least two anchors' worth of score.
+        ChainingParams chain_params = {k};
+        chain_params.min_chain_score = 2 * k;
+        std::vector<AnchorChain> chains = chain_anchors(anchors, chain_params);
+        if (chains.empty()) return;
+        coalesce_anchors(chains[0].anchors, k, found);
+    }
+
+    for (const AnchorSegment& segment : found) {
+        reseed_gap(read, query_begin, ref_begin, segment.query_start, segment.ref_start, k - 2, policy, strand_scratch, out);
+        out.push_back(segment);
+        query_begin = segment.query_start + segment.length;
+        ref_begin = segment.ref_start + segment.length;
+    }
+    reseed_gap(read, query_begin, ref_begin, query_end, ref_end, k - 2, policy, strand_scratch, out);
+}
+
+// Re-seeds the large inner gaps of the read's segments, segments[first, end),
+// and splices the new segments in place.
+void reseed_large_gaps(const PiecewiseRead& read, const AlignmentPolicy& policy, std::string& strand_scratch, size_t first,
+                       std::vector<AnchorSegment>& segments) {
+    if (policy.reseed_gap == 0 || segments.size() < first + 2) return;
+    bool has_large_gap = false;
+    for (size_t i = first + 1; i < segments.size() && !has_large_gap; ++i) {
+        const AnchorSegment& prev = segments[i - 1];
+        const int64_t query_diff = int64_t(segments[i].query_start) - (prev.query_start + prev.length);
+        const int64_t ref_diff = int64_t(segments[i].ref_start) - (prev.ref_start + prev.length);
+        has_large_gap = query_diff > 0 && ref_diff > 0 && static_cast<size_t>(std::max(query_diff, ref_diff)) > policy.reseed_gap;
+    }
+    if (!has_large_gap) return;
+
+    std::vector<AnchorSegment> refined;
+    refined.push_back(segments[first]);
+    for (size_t i = first + 1; i < segments.size(); ++i) {
+        const AnchorSegment& prev = refined.back();
+        reseed_gap(read, prev.query_start + prev.length, prev.ref_start + prev.length, segments[i].query_start, segments[i].ref_start,
+                   policy.reseed_k, policy, strand_scratch, refined);
+        refined.push_back(segments[i]);
+    }
+    segments.resize(first);
+    segments.insert(segments.end(), refined.begin(), refined.end());
+}
+
+// Registers where the references of `reads` come from with the workspace,
+// for the reference window cache, until the scope ends.
+class ReferenceOriginScope {
+public:
+    ReferenceOriginScope(const PiecewiseRead* reads, size_t count, BlockAlignerWorkspace& workspace) : origins_(workspace.reference_origins()) {
+        origins_.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (reads[i].reference_id != kUnknownReference) {
+                origins_.push_back({reads[i].reference, reads[i].reference_id, reads[i].reference_offset});
+            }
+        }
+        std::sort(origins_.begin(), origins_.end(), [](const ReferenceOrigin& a, const ReferenceOrigin& b) {
+            return reinterpret_cast<uintptr_t>(a.bases.data()) < reinterpret_cast<uintptr_t>(b.bases.data());
+        });
+    }
+    ~ReferenceOriginScope() { origins_.clear(); }
+    ReferenceOriginScope(const ReferenceOriginScope&) = delete;
+    ReferenceOriginScope& operator=(const ReferenceOriginScope&) = delete;
+
+private:
+    std::vector<ReferenceOrigin>& origins_;
+};
+
+template <typename Scoring>
+void piecewise_batch_kernel(
+    const PiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const Scoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+) {
+    const ReferenceOriginScope origins(reads, count, workspace);
+    std::vector<AnchorSegment> segments;
+    std::vector<size_t> first_segment(count + 1);
+    std::vector<GapPair> gaps;
+    std::vector<size_t> first_gap(count);
+    for (size_t i = 0; i < count; ++i) {
+        first_segment[i] = segments.size();
+        coalesce_anchors(*reads[i].anchors, k, segments);
+        reseed_large_gaps(reads[i], workspace.policy(), workspace.strand_scratch(), first_segment[i], segments);
+    }
+    first_segment[count] = segments.size();
+
+    // The gap views point into the strand scratch, so it is sized for every
+    // reverse-complement read up front and never reallocates below.
+    std::string& strand_bases = workspace.strand_scratch();
+    strand_bases.clear();
+    strand_bases.reserve(std::accumulate(reads, reads + count, size_t(0), [](size_t bases, const PiecewiseRead& read) {
+        return read.reverse_complement ? bases + read.query.length() : bases;
+    }));
+    for (size_t i = 0; i < count; ++i) {
+        first_gap[i] = gaps.size();
+        collect_inner_gaps(reads[i], segments.data() + first_segment[i], first_segment[i + 1] - first_segment[i], gaps, strand_bases);
+    }
+
+    BatchAlignmentResult aligned_gaps;
+    {
+        PIECEWISE_STAT_SCOPE(AlignmentStage::InnerGaps, std::accumulate(gaps.begin(), gaps.end(), uint64_t(0), [](uint64_t cells, const GapPair& gap) {
+            return cells + gap.query.length() * gap.ref.length();
+        }));
+        global_alignment_batch(gaps.data(), gaps.size(), scoring_params, workspace, aligned_gaps);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = assemble_piecewise_alignment(reads[i], segments.data() + first_segment[i], first_segment[i + 1] - first_segment[i],
+                                                  padding, scoring_params, workspace, aligned_gaps, first_gap[i]);
+    }
+}
+
+}
+
+void piecewise_extension_alignment_batch(
+    const PiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+) {
+    dispatch_scoring(scoring_params, [&](const auto& scoring) {
+        piecewise_batch_kernel(reads, count, k, padding, scoring, workspace, results);
+    });
+}
+
+template <typename Preset>
+void piecewise_extension_alignment_batch(
+    const PiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const Preset& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+) {
+    piecewise_batch_kernel(reads, count, k, padding, scoring_params, workspace, results);
+}
+
+template void piecewise_extension_alignment_batch(const PiecewiseRead*, size_t, const int, const int, const DefaultScoring&, BlockAlignerWorkspace&, AlignmentResult*);
+
+std::vector<AlignmentResult> piecewise_extension_alignment_batch(
+    const std::vector<PiecewiseRead>& reads,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+) {
+    std::vector<AlignmentResult> results(reads.size());
+    piecewise_extension_alignment_batch(reads.data(), reads.size(), k, padding, scoring_params, workspace, results.data());
+    return results;
+}
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+) {
+    PiecewiseRead read = {query, reference, &anchors};
+    AlignmentResult result;
+    piecewise_extension_alignment_batch(&read, 1, k, padding, scoring_params, workspace, &result);
+    return result;
+}
+
+template <typename Preset>
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const Preset& scoring_params,
+    BlockAlignerWorkspace& workspace
+) {
+    PiecewiseRead read = {query, reference, &anchors};
+    AlignmentResult result;
+    piecewise_batch_kernel(&read, 1, k, padding, scoring_params, workspace, &result);
+    return result;
+}
+
+template AlignmentResult piecewise_extension_alignment(std::string_view, std::string_view, const std::vector<Anchor>&, const int, const int, const DefaultScoring&, BlockAlignerWorkspace&);
+
+void reachable_reference(size_t query_length, size_t reference_length, const std::vector<Anchor>& anchors, const int k,
+                         const int padding, size_t& begin, size_t& end) {
+    const size_t lead = anchors.front().query_start + padding;
+    const size_t last_end_query = anchors.back().query_start + k;
+    const size_t tail = query_length > last_end_query ? query_length - last_end_query : 0;
+    begin = anchors.front().ref_start > lead ? anchors.front().ref_start - lead : 0;
+    end = std::min(reference_length, anchors.back().ref_start + k + tail + padding);
+}
+
+namespace {
+
+// Appends the reference window `read` can reach to `out` and returns where it
+// starts in the contig.
+size_t unpack_window(const PackedPiecewiseRead& read, const int k, const int padding, std::string& out) {
+    size_t begin;
+    size_t end;
+    reachable_reference(read.query.length(), read.reference->length(), *read.anchors, k, padding, begin, end);
+    const size_t offset = out.size();
+    out.resize(offset + (end - begin));
+    read.reference->unpack(begin, end - begin, out.data() + offset);
+    return begin;
+}
+
+}
+
+void piecewise_extension_alignment_batch(
+    const PackedPiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+) {
+    std::vector<size_t> window_begin(count);
+    std::vector<size_t> unpacked_end(count);
+    std::string& unpacked = workspace.unpack_scratch();
+    unpacked.clear();
+    for (size_t i = 0; i < count; ++i) {
+        window_begin[i] = unpack_window(reads[i], k, padding, unpacked);
+        unpacked_end[i] = unpacked.size();
+    }
+
+    // Views are taken once the scratch has stopped growing.
+    std::vector<std::vector<Anchor>> shifted(count);
+    std::vector<PiecewiseRead> windows(count);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        shifted[i] = *reads[i].anchors;
+        for (auto& anchor : shifted[i]) anchor.ref_start -= window_begin[i];
+        windows[i] = {reads[i].query, std::string_view(unpacked).substr(offset, unpacked_end[i] - offset), &shifted[i], reads[i].reverse_complement,
+                      reads[i].reference_id, reads[i].reference_offset + window_begin[i]};
+        offset = unpacked_end[i];
+    }
+
+    piecewise_extension_alignment_batch(windows.data(), count, k, padding, scoring_params, workspace, results);
+    for (size_t i = 0; i < count; ++i) {
+        results[i].ref_start += window_begin[i];
+        results[i].ref_end += window_begin[i];
+    }
+}
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    const PackedSequence& reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+) {
+    PackedPiecewiseRead read = {query, &reference, &anchors};
+    AlignmentResult result;
+    piecewise_extension_alignment_batch(&read, 1, k, padding, scoring_params, workspace, &result);
+    return result;
+}
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params
+) {
+    BlockAlignerWorkspace workspace;
+    return piecewise_extension_alignment(query, reference, anchors, k, padding, scoring_params, workspace);
+}
+
+namespace {
+
+// Workspace of the pool worker running the calling task. It lives as long as
+// the worker's thread, so every batch and every concurrent align_batch caller
+// on the pool reuses its buffers; only the policy is set again. A worker runs
+// one task at a time, and no task keeps using the workspace across a wait that
+// could run another task inline.
+BlockAlignerWorkspace& worker_workspace(const AlignmentPolicy& policy) {
+    thread_local BlockAlignerWorkspace workspace;
+    workspace.set_policy(policy);
+    return workspace;
+}
+
+// Aligns one read with its end extensions and spans of its segments as
+// separate tasks on `pool`, then stitches the pieces in order. A span task
+// re-seeds and aligns the gaps between its segments on its own, as each gap
+// only depends on the two segments around it. Each task uses the workspace of
+// the worker running it (see worker_workspace); none is held across the wait.
+template <typename Scoring>
+AlignmentResult split_read_kernel(
+    const PiecewiseRead& read,
+    const PiecewiseParams& params,
+    const Scoring& scoring_params,
+    WorkStealingPool& pool
+) {
+    std::vector<AnchorSegment> segments;
+    coalesce_anchors(*read.anchors, params.k, segments);
+
+    // Span s covers segments[span_begin[s]] to segments[span_begin[s + 1]],
+    // so neighbouring spans share their boundary segment.
+    std::vector<size_t> span_begin = {0};
+    for (size_t i = 1; i < segments.size(); ++i) {
+        if (segments[i].query_start - segments[span_begin.back()].query_start >= kAlignBatchTaskBases || i + 1 == segments.size()) {
+            span_begin.push_back(i);
+        }
+    }
+
+    TaskGroup group;
+    AlignmentResult prefix = {};
+    AlignmentResult suffix = {};
+    CigarBuilder prefix_cigar;
+    CigarBuilder suffix_cigar;
+    pool.submit(group, [&](size_t) {
+        BlockAlignerWorkspace& workspace = worker_workspace(params.policy);
+        const ReferenceOriginScope origins(&read, 1, workspace);
+        extend_prefix(read, segments.front(), params.padding, scoring_params, workspace, prefix_cigar, prefix);
+    });
+    pool.submit(group, [&](size_t) {
+        BlockAlignerWorkspace& workspace = worker_workspace(params.policy);
+        const ReferenceOriginScope origins(&read, 1, workspace);
+        extend_suffix(read, segments.back(), params.padding, scoring_params, workspace, suffix_cigar, suffix);
+    });
+    std::vector<AlignmentResult> spans(span_begin.size() - 1);
+    std::vector<CigarBuilder> span_cigars(spans.size());
+    for (size_t s = 0; s < spans.size(); ++s) {
+        pool.submit(group, [&, s](size_t) {
+            BlockAlignerWorkspace& workspace = worker_workspace(params.policy);
+            const ReferenceOriginScope origins(&read, 1, workspace);
+            std::vector<AnchorSegment> span(segments.begin() + span_begin[s], segments.begin() + span_begin[s + 1] + 1);
+            std::string& strand_bases = workspace.strand_scratch();
+            reseed_large_gaps(read, params.policy, strand_bases, 0, span);
+            strand_bases.clear();
+            if (read.reverse_complement) strand_bases.reserve(span.back().query_start - span.front().query_start);
+            std::vector<GapPair> gaps;
+            collect_inner_gaps(read, span.data(), span.size(), gaps, strand_bases);
+            BatchAlignmentResult aligned_gaps;
+            {
+                PIECEWISE_STAT_SCOPE(AlignmentStage::InnerGaps, std::accumulate(gaps.begin(), gaps.end(), uint64_t(0), [](uint64_t cells, const GapPair& gap) {
+                    return cells + gap.query.length() * gap.ref.length();
+                }));
+                global_alignment_batch(gaps.data(), gaps.size(), scoring_params, workspace, aligned_gaps);
+            }
+            spans[s].score = 0;
+            stitch_segments(span.data(), span.size(), scoring_params, aligned_gaps, 0, span_cigars[s], spans[s]);
+        });
+    }
+    pool.wait(group);
+
+    AlignmentResult result = {};
+    result.score = prefix.score + segments.front().length * scoring_params.match + suffix.score;
+    result.query_start = prefix.query_start;
+    result.ref_start = prefix.ref_start;
+    result.query_end = suffix.query_end;
+    result.ref_end = suffix.ref_end;
+    result.reverse_complement = read.reverse_complement;
+    CigarBuilder cigar;
+    cigar.append(prefix_cigar.begin(), prefix_cigar.end());
+    cigar.push(Operation::Eq, segments.front().length);
+    for (size_t s = 0; s < spans.size(); ++s) {
+        result.score += spans[s].score;
+        cigar.append(span_cigars[s].begin(), span_cigars[s].end());
+    }
+    cigar.append(suffix_cigar.begin(), suffix_cigar.end());
+    finish_cigar(read, params.policy.soft_clip, cigar, result);
+    return result;
+}
+
+AlignmentResult split_read_on_pool(const PiecewiseRead& read, const PiecewiseParams& params, WorkStealingPool& pool) {
+    return dispatch_scoring(params.scoring, [&](const auto& scoring) {
+        return split_read_kernel(read, params, scoring, pool);
+    });
+}
+
+AlignmentResult split_read_on_pool(const PackedPiecewiseRead& read, const PiecewiseParams& params, WorkStealingPool& pool) {
+    std::string window;
+    const size_t window_begin = unpack_window(read, params.k, params.padding, window);
+    std::vector<Anchor> shifted = *read.anchors;
+    for (auto& anchor : shifted) anchor.ref_start -= window_begin;
+    AlignmentResult result = split_read_on_pool(
+        PiecewiseRead{read.query, window, &shifted, read.reverse_complement, read.reference_id, read.reference_offset + window_begin}, params, pool);
+    result.ref_start += window_begin;
+    result.ref_end += window_begin;
+    return result;
+}
+
+template <typename Read>
+std::vector<AlignmentResult> align_batch_on_pool(const std::vector<Read>& reads, const PiecewiseParams& params, WorkStealingPool& pool) {
+    std::vector<AlignmentResult> results(reads.size());
+    TaskGroup group;
+
+    const auto is_split = [&](const Read& read) {
+        return params.split_read_bases > 0 && read.query.length() >= params.split_read_bases;
+    };
+    size_t begin = 0;
+    while (begin < reads.size()) {
+        if (is_split(reads[begin])) {
+            pool.submit(group, [&, begin](size_t) {
+                results[begin] = split_read_on_pool(reads[begin], params, pool);
+            });
+            begin++;
+            continue;
+        }
+        size_t end = begin;
+        size_t bases = 0;
+        while (end < reads.size() && !is_split(reads[end]) && end - begin < kAlignBatchTaskReads &&
+               (end == begin || bases + reads[end].query.length() <= kAlignBatchTaskBases)) {
+            bases += reads[end].query.length();
+            end++;
+        }
+        pool.submit(group, [&, begin, end](size_t) {
+            piecewise_extension_alignment_batch(reads.data() + begin, end - begin, params.k, params.padding, params.scoring, worker_workspace(params.policy),
+                                                results.data() + begin);
+        });
+        begin = end;
+    }
+
+    pool.wait(group);
+    return results;
+}
+
+}
+
+AlignmentResult align_split_read(const PiecewiseRead& read, const PiecewiseParams& params, WorkStealingPool& pool) {
+    return split_read_on_pool(read, params, pool);
+}
+
+std::vector<AlignmentResult> align_batch(const std::vector<PiecewiseRead>& reads, const PiecewiseParams& params, WorkStealingPool& pool) {
+    return align_batch_on_pool(reads, params, pool);
+}
+
+std::vector<AlignmentResult> align_batch(const std::vector<PackedPiecewiseRead>& reads, const PiecewiseParams& params, WorkStealingPool& pool) {
+    return align_batch_on_pool(reads, params, pool);
+}
+
+std::vector<AlignmentResult> align_batch(const std::vector<PiecewiseRead>& reads, const PiecewiseParams& params, size_t threads) {
+    WorkStealingPool pool(threads);
+    return align_batch(reads, params, pool);
+}
+
+std::vector<AlignmentResult> align_batch(
+    const std::vector<std::string_view>& queries,
+    std::string_view reference,
+    const std::vector<std::vector<Anchor>>& anchors,
+    const PiecewiseParams& params,
+    size_t threads
+) {
+    std::vector<PiecewiseRead> reads;
+    reads.reserve(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        reads.push_back({queries[i], reference, &anchors[i]});
+    }
+    return align_batch(reads, params, threads);
+}
@@ -0,0 +1,197 @@
+#ifndef PIECEWISE_ALIGNER_H
+#define PIECEWISE_ALIGNER_H
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include "baligner.hpp"
+#include "packed_sequence.hpp"
+#include "thread_pool.hpp"
+
+struct Anchor {
+    uint query_start;
+    uint ref_start;
+};
+
+// Exact match of `length` bases, made of one or more anchors on the same
+// diagonal that overlap or touch.
+struct AnchorSegment {
+    uint query_start;
+    uint ref_start;
+    uint length;
+};
+
+// Appends the segments of a sorted anchor chain to `segments`. Runs of dense
+// anchors on one diagonal become a single segment, so the extension walks
+// segments instead of k-mers and emits one Eq op per run.
+void coalesce_anchors(const std::vector<Anchor>& anchors, const int k, std::vector<AnchorSegment>& segments);
+
+// One read to align: a query, the reference it maps to and its anchor chain,
+// sorted by query and reference position.
+//
+// A read on the minus strand is passed as sequenced with reverse_complement
+// set. Its anchors, CIGAR and coordinates are then those of the reverse
+// complement on the forward reference strand, as in SAM, but the read is never
+// copied as a whole: only the bases of its gaps and end extensions are
+// complemented, as they are handed to the aligners.
+//
+// When the caller knows where `reference` lies in a larger sequence, it sets
+// reference_id to an id of that sequence (e.g. a contig index) and
+// reference_offset to the start of `reference` in it, so the reference window
+// cache finds windows by position instead of hashing their bases.
+constexpr uint64_t kUnknownReference = ~uint64_t(0);
+
+struct PiecewiseRead {
+    std::string_view query;
+    std::string_view reference;
+    const std::vector<Anchor>* anchors;
+    bool reverse_complement = false;
+    uint64_t reference_id = kUnknownReference;
+    uint64_t reference_offset = 0;
+};
+
+// Same as PiecewiseRead, against a 2-bit packed reference. reference_id and
+// reference_offset describe the packed sequence as a whole; each window
+// unpacked from it is then known by its own offset rather than its scratch
+// address.
+struct PackedPiecewiseRead {
+    std::string_view query;
+    const PackedSequence* reference;
+    const std::vector<Anchor>* anchors;
+    bool reverse_complement = false;
+    uint64_t reference_id = kUnknownReference;
+    uint64_t reference_offset = 0;
+};
+
+struct PiecewiseParams {
+    int k;
+    int padding;
+    AlignmentScoring scoring;
+    AlignmentPolicy policy = {};
+    // align_batch splits reads at least this long into a task per end
+    // extension and per chunk of inner gaps; 0 keeps every read in one task.
+    size_t split_read_bases = size_t(1) << 16;
+};
+
+// Reference span [begin, end) that a query of `query_length` aligned along
+// the sorted `anchors` can reach, clamped the same way the end extensions
+// clamp their reference parts. Aligning against just this span, with the
+// anchors shifted by `begin`, gives the same alignment shifted by `begin`.
+void reachable_reference(size_t query_length, size_t reference_length, const std::vector<Anchor>& anchors, const int k,
+                         const int padding, size_t& begin, size_t& end);
+
+std::vector<OpLen> merge_cigar_elements(const std::vector<OpLen>& elements);
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params
+);
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+);
+
+// Aligns several reads at once: the inner gaps of all reads are collected first
+// and sent through global_alignment_batch in a single call.
+void piecewise_extension_alignment_batch(
+    const PiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+);
+
+std::vector<AlignmentResult> piecewise_extension_alignment_batch(
+    const std::vector<PiecewiseRead>& reads,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+);
+
+// String-reference entry points with the scoring fixed at compile time to one
+// of the presets in baligner.hpp. The AlignmentScoring overloads dispatch to
+// these when the scoring matches a preset.
+template <typename Preset>
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    std::string_view reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const Preset& scoring_params,
+    BlockAlignerWorkspace& workspace
+);
+
+template <typename Preset>
+void piecewise_extension_alignment_batch(
+    const PiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const Preset& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+);
+
+// Packed-reference variants: only the reference window each read can reach
+// (its anchor span plus the query overhangs and padding) is unpacked, into the
+// workspace's unpack scratch, and the results are in contig coordinates.
+void piecewise_extension_alignment_batch(
+    const PackedPiecewiseRead* reads,
+    size_t count,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace,
+    AlignmentResult* results
+);
+
+AlignmentResult piecewise_extension_alignment(
+    std::string_view query,
+    const PackedSequence& reference,
+    const std::vector<Anchor>& anchors,
+    const int k,
+    const int padding,
+    const AlignmentScoring& scoring_params,
+    BlockAlignerWorkspace& workspace
+);
+
+// Aligns a batch of reads on a work-stealing pool. Reads are grouped into tasks
+// of roughly kAlignBatchTaskBases query bases (a long read is a task of its
+// own, or several once it reaches params.split_read_bases), and each task
+// writes its results straight into its slots of the output, so results come
+// back in input order whatever order the tasks finish in. Every worker keeps
+// one BlockAlignerWorkspace for the life of the pool, which later batches and
+// concurrent callers reuse with only the policy set again.
+constexpr size_t kAlignBatchTaskBases = 1 << 15;
+constexpr size_t kAlignBatchTaskReads = 256;
+
+// Aligns a single read with its end extensions and chunks of its inner gaps
+// running as parallel tasks on `pool`. Gives the same result as the serial
+// piecewise_extension_alignment.
+AlignmentResult align_split_read(const PiecewiseRead& read, const PiecewiseParams& params, WorkStealingPool& pool);
+
+std::vector<AlignmentResult> align_batch(const std::vector<PiecewiseRead>& reads, const PiecewiseParams& params, WorkStealingPool& pool);
+std::vector<AlignmentResult> align_batch(const std::vector<PiecewiseRead>& reads, const PiecewiseParams& params, size_t threads);
+std::vector<AlignmentResult> align_batch(const std::vector<PackedPiecewiseRead>& reads, const PiecewiseParams& params, WorkStealingPool& pool);
+std::vector<AlignmentResult> align_batch(
+    const std::vector<std::string_view>& queries,
+    std::string_view reference,
+    const std::vector<std::vector<Anchor>>& anchors,
+    const PiecewiseParams& params,
+    size_t threads
+);
+
+#endif
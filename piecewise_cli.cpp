@@ -0,0 +1,457 @@
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <getopt.h>
+#include "alignment_cache.hpp"
+#include "alignment_stats.hpp"
+#include "baligner.hpp"
+#include "chaining.hpp"
+#include "minimizer_index.hpp"
+#include "output_writer.hpp"
+#include "piecewise.hpp"
+#include "pipeline.hpp"
+#include "reference_cache.hpp"
+#include "sequence_io.hpp"
+#include "sequence_view.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+struct CliOptions {
+    std::string reference_path;
+    std::string reads_path;
+    std::string anchors_path;
+    std::string index_path;
+    std::string output_path = "-";
+    std::string stats_path;
+    OutputFormat format = OutputFormat::Sam;
+    size_t threads = 0;
+    size_t batch_size = 4096;
+    size_t seed_threads = 2;
+    size_t align_batches = 2;
+    size_t queue_depth = 4;
+    size_t reference_cache_mb = 0;
+    size_t alignment_cache_mb = 0;
+    PiecewiseParams params = {15, 10, {3, -1, -3, -1}};
+    int window = 10;
+};
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <reference.fa> <reads.fq|reads.fa> [anchors.tsv]\n"
+              << "       " << program << " index [-k INT] [-w INT] [-t INT] <reference.fa> <out.idx>\n"
+              << "\n"
+              << "Anchors are tab-separated lines: read_name, contig, query_start, ref_start,\n"
+              << "on the forward strand.\n"
+              << "Lines of one read must be contiguous and in the same order as the reads.\n"
+              << "Without an anchor file, anchors are looked up in a minimizer index, loaded\n"
+              << "with -i or built in memory, for the read and its reverse complement. Raw\n"
+              << "anchors are chained first and only the best chain is extended.\n"
+              << "\n"
+              << "Options:\n"
+              << "  -i FILE minimizer index built by 'index' (its k must match -k)\n"
+              << "  -w INT  minimizer window (default: 10)\n"
+              << "  -o FILE output file (default: stdout)\n"
+              << "  -f STR  output format, sam or paf (default: sam)\n"
+              << "  -t INT  worker threads (default: all cores)\n"
+              << "  -k INT  anchor length (default: 15)\n"
+              << "  -p INT  reference padding for end extensions (default: 10)\n"
+              << "  -b INT  reads per batch (default: 4096)\n"
+              << "  -s INT  seeding threads (default: 2)\n"
+              << "  -a INT  batches aligned at once on the worker threads (default: 2)\n"
+              << "  -q INT  batches queued between pipeline stages (default: 4)\n"
+              << "  -A INT  match score (default: 3)\n"
+              << "  -B INT  mismatch score (default: -1)\n"
+              << "  -O INT  gap open score (default: -3)\n"
+              << "  -E INT  gap extend score (default: -1)\n"
+              << "  -e NUM  expected error rate, sizes blocks and x-drop (default: 0.1)\n"
+              << "  -X INT  x-drop for end extensions (default: derived from -e)\n"
+              << "  -L      local mode: stop end extensions at the x-drop, soft-clip the rest\n"
+              << "  -R INT  re-seed inner gaps longer than INT bases, 0 to disable (default: 1000)\n"
+              << "  -T INT  traceback memory budget per alignment in MB, 0 for none (default: 64)\n"
+              << "  -C INT  cache reference windows and their profiles in up to INT MB, for\n"
+              << "          reads piling up on the same windows (amplicons), 0 to disable (default: 0)\n"
+              << "  -M INT  memoize gap alignments and end extensions in up to INT MB and report\n"
+              << "          the hit rate on stderr, 0 to disable (default: 0)\n"
+              << "  -S FILE write per-stage statistics as JSON (needs a STATS=1 build)\n";
+}
+
+template <typename T>
+T parse_number(std::string_view text, const char* what) {
+    T value{};
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || ptr != text.data() + text.size()) {
+        throw std::runtime_error(std::string("invalid ") + what + ": '" + std::string(text) + "'");
+    }
+    return value;
+}
+
+// Streams the anchor file alongside the reads, one read's block of lines at a
+// time.
+class AnchorFileReader {
+public:
+    explicit AnchorFileReader(const std::string& path) : lines_(path) {
+        advance();
+    }
+
+    // Fills `anchors` and `contig` for `read_name`. Returns false if the next
+    // block of lines belongs to another read, i.e. this read has no anchors.
+    bool read_anchors(std::string_view read_name, std::string& contig, std::vector<Anchor>& anchors) {
+        anchors.clear();
+        while (has_line_ && name_ == read_name) {
+            contig = contig_;
+            anchors.push_back(anchor_);
+            advance();
+        }
+        return !anchors.empty();
+    }
+
+private:
+    void advance() {
+        std::string_view line;
+        has_line_ = false;
+        while (lines_.next(line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::string_view fields[4];
+            size_t count = 0;
+            while (count < 4) {
+                size_t tab = line.find('\t');
+                fields[count++] = line.substr(0, tab);
+                if (tab == std::string_view::npos) break;
+                line.remove_prefix(tab + 1);
+            }
+            if (count < 4) {
+                throw std::runtime_error("malformed anchor line for read '" + std::string(fields[0]) + "'");
+            }
+            name_.assign(fields[0]);
+            contig_.assign(fields[1]);
+            anchor_.query_start = parse_number<uint>(fields[2], "anchor query_start");
+            anchor_.ref_start = parse_number<uint>(fields[3], "anchor ref_start");
+            has_line_ = true;
+            return;
+        }
+    }
+
+    LineReader lines_;
+    bool has_line_ = false;
+    std::string name_;
+    std::string contig_;
+    Anchor anchor_ = {0, 0};
+};
+
+CliOptions parse_options(int argc, char** argv) {
+    CliOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:w:o:f:t:k:p:b:s:a:q:A:B:O:E:e:X:LR:T:C:M:S:h")) != -1) {
+        switch (opt) {
+            case 'i': options.index_path = optarg; break;
+            case 'w': options.window = parse_number<int>(optarg, "window"); break;
+            case 'o': options.output_path = optarg; break;
+            case 'f':
+                if (std::string_view(optarg) == "sam") {
+                    options.format = OutputFormat::Sam;
+                } else if (std::string_view(optarg) == "paf") {
+                    options.format = OutputFormat::Paf;
+                } else {
+                    print_usage(argv[0]);
+                    std::exit(1);
+                }
+                break;
+            case 't': options.threads = parse_number<size_t>(optarg, "thread count"); break;
+            case 'k': options.params.k = parse_number<int>(optarg, "k"); break;
+            case 'p': options.params.padding = parse_number<int>(optarg, "padding"); break;
+            case 'b': options.batch_size = parse_number<size_t>(optarg, "batch size"); break;
+            case 's': options.seed_threads = parse_number<size_t>(optarg, "seeding thread count"); break;
+            case 'a': options.align_batches = parse_number<size_t>(optarg, "aligned batch count"); break;
+            case 'q': options.queue_depth = parse_number<size_t>(optarg, "queue depth"); break;
+            case 'A': options.params.scoring.match = parse_number<int8_t>(optarg, "match score"); break;
+            case 'B': options.params.scoring.mismatch = parse_number<int8_t>(optarg, "mismatch score"); break;
+            case 'O': options.params.scoring.gap_open = parse_number<int8_t>(optarg, "gap open score"); break;
+            case 'E': options.params.scoring.gap_extend = parse_number<int8_t>(optarg, "gap extend score"); break;
+            case 'e': options.params.policy.error_rate = parse_number<double>(optarg, "error rate"); break;
+            case 'X': options.params.policy.x_drop = parse_number<int32_t>(optarg, "x-drop"); break;
+            case 'L': options.params.policy.soft_clip = true; break;
+            case 'R': options.params.policy.reseed_gap = parse_number<size_t>(optarg, "re-seed gap"); break;
+            case 'T': options.params.policy.trace_budget = parse_number<size_t>(optarg, "trace budget") << 20; break;
+            case 'C': options.reference_cache_mb = parse_number<size_t>(optarg, "reference cache size"); break;
+            case 'M': options.alignment_cache_mb = parse_number<size_t>(optarg, "alignment cache size"); break;
+            case 'S': options.stats_path = optarg; break;
+            case 'h': print_usage(argv[0]); std::exit(0);
+            default: print_usage(argv[0]); std::exit(1);
+        }
+    }
+    if (!options.stats_path.empty() && !PIECEWISE_STATS_ENABLED) {
+        std::cerr << "warning: built without PIECEWISE_STATS, -S writes empty statistics" << std::endl;
+    }
+    if (argc - optind != 2 && argc - optind != 3) {
+        print_usage(argv[0]);
+        std::exit(1);
+    }
+    options.reference_path = argv[optind];
+    options.reads_path = argv[optind + 1];
+    if (argc - optind == 3) options.anchors_path = argv[optind + 2];
+    if (options.batch_size == 0) options.batch_size = 1;
+    return options;
+}
+
+int run_index(int argc, char** argv) {
+    MinimizerParams params;
+    size_t threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:w:t:h")) != -1) {
+        switch (opt) {
+            case 'k': params.k = parse_number<int>(optarg, "k"); break;
+            case 'w': params.w = parse_number<int>(optarg, "window"); break;
+            case 't': threads = parse_number<size_t>(optarg, "thread count"); break;
+            case 'h': print_usage("piecewise"); return 0;
+            default: print_usage("piecewise"); return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        print_usage("piecewise");
+        return 1;
+    }
+    try {
+        MappedReference reference(argv[optind]);
+        WorkStealingPool pool(threads);
+        MinimizerIndex::build(reference, params, pool).save(argv[optind + 1]);
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// One batch of reads on its way through the pipeline. It is handed from stage
+// to stage by pointer, so the read buffer and the views into it never move.
+struct PipelineBatch {
+    size_t sequence = 0;
+    ReadBatch reads;
+    std::vector<std::vector<Anchor>> anchors;
+    std::vector<const MappedContig*> contigs;
+    // The reference window each read can reach, by read, and where it starts
+    // in the contig, by aligned read. The anchors of an aligned read are
+    // shifted to its window.
+    std::vector<std::string> windows;
+    std::vector<size_t> window_begin;
+    std::vector<PiecewiseRead> aligned_reads;
+    std::vector<size_t> aligned_index;
+    std::vector<AlignmentResult> results;
+};
+
+using BatchPtr = std::unique_ptr<PipelineBatch>;
+
+// Rejects anchors that would make the aligner slice past the read or the
+// contig and, once `chained`, chains that do not increase in both coordinates.
+void check_anchors(std::string_view read_name, std::string_view read, const MappedContig& contig, int k, const std::vector<Anchor>& anchors,
+                   bool chained) {
+    for (size_t i = 0; i < anchors.size(); ++i) {
+        const Anchor& anchor = anchors[i];
+        if (size_t(anchor.query_start) + k > read.length() || size_t(anchor.ref_start) + k > contig.length) {
+            throw std::runtime_error("anchor (" + std::to_string(anchor.query_start) + ", " + std::to_string(anchor.ref_start) +
+                                     ") of read '" + std::string(read_name) + "' lies outside the read or contig '" + std::string(contig.name) + "'");
+        }
+        if (chained && i > 0 && (anchor.query_start <= anchors[i - 1].query_start || anchor.ref_start <= anchors[i - 1].ref_start)) {
+            throw std::runtime_error("anchors of read '" + std::string(read_name) + "' are not sorted");
+        }
+    }
+}
+
+// Chains the anchors of every contig the read hits, on both strands, and
+// keeps the best chain. The index holds forward k-mers only, so the minus
+// strand is looked up with the reverse complement of the read, spelled out in
+// `reverse_bases`, and its anchors are those of the reverse complement.
+const MappedContig* best_indexed_chain(const MinimizerIndex& index, const MappedReference& reference, std::string_view read,
+                                       int k, std::vector<ContigAnchors>& hits, std::string& reverse_bases,
+                                       std::vector<Anchor>& anchors, bool& reverse_complement) {
+    reverse_bases.resize(read.length());
+    ReverseComplementView(read).copy(reverse_bases.data());
+    const MappedContig* best_contig = nullptr;
+    int best_score = 0;
+    for (bool reverse : {false, true}) {
+        index.find_anchors(reverse ? std::string_view(reverse_bases) : read, hits);
+        for (const auto& hit : hits) {
+            std::vector<AnchorChain> chains = chain_anchors(hit.anchors, {k});
+            if (chains.empty() || (best_contig && chains[0].score <= best_score)) continue;
+            best_contig = &reference.contigs()[hit.contig];
+            best_score = chains[0].score;
+            anchors = std::move(chains[0].anchors);
+            reverse_complement = reverse;
+        }
+    }
+    return best_contig;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "index") {
+        return run_index(argc - 1, argv + 1);
+    }
+    CliOptions options = parse_options(argc, argv);
+
+    try {
+        MappedReference reference(options.reference_path);
+        FastxReader reads(options.reads_path);
+        WorkStealingPool pool(options.threads);
+        std::unique_ptr<ReferenceWindowCache> reference_cache;
+        if (options.reference_cache_mb > 0) {
+            reference_cache = std::make_unique<ReferenceWindowCache>(options.reference_cache_mb << 20);
+            options.params.policy.reference_cache = reference_cache.get();
+        }
+        std::unique_ptr<GapAlignmentCache> alignment_cache;
+        if (options.alignment_cache_mb > 0) {
+            alignment_cache = std::make_unique<GapAlignmentCache>(options.alignment_cache_mb << 20);
+            options.params.policy.alignment_cache = alignment_cache.get();
+        }
+        std::unique_ptr<AnchorFileReader> anchor_file;
+        MinimizerIndex index;
+        if (!options.anchors_path.empty()) {
+            anchor_file = std::make_unique<AnchorFileReader>(options.anchors_path);
+        } else if (!options.index_path.empty()) {
+            index = MinimizerIndex::load(options.index_path);
+        } else {
+            index = MinimizerIndex::build(reference, {options.params.k, options.window}, pool);
+        }
+        if (!anchor_file) {
+            if (index.params().k != options.params.k) {
+                throw std::runtime_error("index k=" + std::to_string(index.params().k) + " does not match -k " + std::to_string(options.params.k));
+            }
+            if (index.contig_count() != reference.contigs().size()) {
+                throw std::runtime_error("index was built from a different reference");
+            }
+        }
+        OutputSink sink(options.output_path);
+        AlignmentWriter writer(sink, options.format);
+        writer.write_header(reference.contigs());
+
+        // Reading, seeding, aligning and writing overlap: each stage works on
+        // its own batch while bounded queues between them cap the batches in
+        // flight. The queues alone do not bound the batches the writer holds
+        // back for reordering behind a slow one, so the reader also takes a
+        // credit per batch, which the writer returns once the batch is written.
+        size_t read_sequence = 0;
+        size_t next_sequence = 0;
+        std::map<size_t, BatchPtr> pending;
+        Pipeline pipeline;
+        auto& read_queue = pipeline.queue<BatchPtr>(options.queue_depth);
+        auto& seeded_queue = pipeline.queue<BatchPtr>(options.queue_depth);
+        auto& aligned_queue = pipeline.queue<BatchPtr>(options.queue_depth);
+        const size_t max_batches = 3 * options.queue_depth + options.seed_threads + options.align_batches + 2;
+        auto& credits = pipeline.queue<char>(max_batches);
+        for (size_t i = 0; i < max_batches; ++i) credits.push(0);
+
+        pipeline.source(read_queue, [&](BatchPtr& batch) {
+            char credit;
+            if (!credits.pop(credit)) return false;
+            batch = std::make_unique<PipelineBatch>();
+            if (fill_read_batch(reads, batch->reads, options.batch_size) == 0) return false;
+            batch->sequence = read_sequence++;
+            batch->anchors.resize(batch->reads.size());
+            batch->contigs.assign(batch->reads.size(), nullptr);
+            batch->windows.resize(batch->reads.size());
+            // The anchor file streams alongside the reads, so it is read here.
+            for (size_t i = 0; anchor_file && i < batch->reads.size(); ++i) {
+                std::string contig_name;
+                if (!anchor_file->read_anchors(batch->reads.names[i], contig_name, batch->anchors[i])) continue;
+                batch->contigs[i] = reference.find(contig_name);
+                if (!batch->contigs[i]) {
+                    throw std::runtime_error("unknown contig '" + contig_name + "' for read '" + std::string(batch->reads.names[i]) + "'");
+                }
+            }
+            return true;
+        });
+
+        pipeline.stage(read_queue, seeded_queue, options.seed_threads,
+                       [&, hits = std::vector<ContigAnchors>(), reverse_bases = std::string()](BatchPtr batch) mutable {
+            for (size_t i = 0; i < batch->reads.size(); ++i) {
+                std::vector<Anchor>& anchors = batch->anchors[i];
+                bool reverse_complement = false;
+                if (anchor_file) {
+                    if (!batch->contigs[i]) continue;
+                    // Raw anchors may come in any order; chaining sorts them.
+                    check_anchors(batch->reads.names[i], batch->reads.sequences[i], *batch->contigs[i], options.params.k, anchors, false);
+                    std::vector<AnchorChain> chains = chain_anchors(anchors, {options.params.k});
+                    if (chains.empty()) {
+                        batch->contigs[i] = nullptr;
+                        continue;
+                    }
+                    anchors = std::move(chains[0].anchors);
+                } else {
+                    batch->contigs[i] = best_indexed_chain(index, reference, batch->reads.sequences[i], options.params.k, hits, reverse_bases,
+                                                           anchors, reverse_complement);
+                    if (!batch->contigs[i]) continue;
+                }
+                check_anchors(batch->reads.names[i], batch->reads.sequences[i], *batch->contigs[i], options.params.k, anchors, true);
+                size_t begin;
+                size_t end;
+                reachable_reference(batch->reads.sequences[i].length(), batch->contigs[i]->length, anchors, options.params.k,
+                                    options.params.padding, begin, end);
+                for (auto& anchor : anchors) anchor.ref_start -= begin;
+                const std::string_view window = reference.bases(*batch->contigs[i], begin, end - begin, batch->windows[i]);
+                // The contig and offset let the reference window cache key
+                // windows by position, whether or not they were copied.
+                const uint64_t contig_index = batch->contigs[i] - reference.contigs().data();
+                batch->aligned_reads.push_back({batch->reads.sequences[i], window, &anchors, reverse_complement, contig_index, begin});
+                batch->aligned_index.push_back(i);
+                batch->window_begin.push_back(begin);
+            }
+            return batch;
+        });
+
+        // Up to align_batches batches are aligned at once on the one pool, all
+        // on the workspaces its workers keep, so batches in flight cost no
+        // aligner setup of their own.
+        pipeline.stage(seeded_queue, aligned_queue, options.align_batches, [&](BatchPtr batch) {
+            batch->results = align_batch(batch->aligned_reads, options.params, pool);
+            for (size_t j = 0; j < batch->results.size(); ++j) {
+                batch->results[j].ref_start += batch->window_begin[j];
+                batch->results[j].ref_end += batch->window_begin[j];
+            }
+            return batch;
+        });
+
+        // Batches leave the multi-threaded stages out of order and are put
+        // back in input order here.
+        pipeline.sink(aligned_queue, [&](BatchPtr batch) {
+            pending.emplace(batch->sequence, std::move(batch));
+            for (auto next = pending.begin(); next != pending.end() && next->first == next_sequence; next = pending.erase(next)) {
+                const PipelineBatch& ready = *next->second;
+                size_t next_aligned = 0;
+                for (size_t i = 0; i < ready.reads.size(); ++i) {
+                    const AlignmentResult* result = nullptr;
+                    if (next_aligned < ready.aligned_index.size() && ready.aligned_index[next_aligned] == i) {
+                        result = &ready.results[next_aligned++];
+                    }
+                    writer.write(ready.reads.names[i], ready.reads.sequences[i], ready.reads.qualities[i], ready.contigs[i], result);
+                }
+                next_sequence++;
+                credits.push(0);
+            }
+        });
+
+        pipeline.wait();
+        writer.flush();
+
+        if (alignment_cache) {
+            std::cerr << "alignment cache: " << alignment_cache->hits() << " hits, " << alignment_cache->misses()
+                      << " misses (" << 100.0 * alignment_cache->hit_rate() << "% hit rate)" << std::endl;
+        }
+
+        if (!options.stats_path.empty()) {
+            OutputSink stats_sink(options.stats_path);
+            const std::string json = collect_alignment_stats().to_json();
+            stats_sink.write(json.data(), json.size());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
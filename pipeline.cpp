@@ -0,0 +1,40 @@
+#include "pipeline.hpp"
+
+Pipeline::~Pipeline() {
+    fail(nullptr);
+    for (auto& thread : threads_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void Pipeline::wait() {
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    if (error_) std::rethrow_exception(error_);
+}
+
+void Pipeline::spawn(size_t threads, std::function<void()> body, QueueBase* output) {
+    auto running = std::make_shared<std::atomic<size_t>>(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this, body, output, running]() mutable {
+            try {
+                body();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            if (--*running == 0 && output) output->close();
+        });
+    }
+}
+
+// Closing every queue unblocks all stages, which then run out of input or
+// fail to push and return.
+void Pipeline::fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) error_ = error;
+    for (auto& queue : queues_) {
+        queue->close();
+    }
+}
@@ -0,0 +1,255 @@
+#ifndef PIECEWISE_PIPELINE_H
+#define PIECEWISE_PIPELINE_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Type-erased part of a queue, so a Pipeline can close all of its queues.
+class QueueBase {
+public:
+    virtual ~QueueBase() = default;
+    virtual void close() = 0;
+};
+
+// Bounded multi-producer multi-consumer queue. Items move through a ring of
+// cells guarded by per-cell sequence numbers, so try_push and try_pop never
+// lock. push and pop sleep only when the queue is full or empty, which is how
+// a slow stage holds back the stages before it.
+template <typename T>
+class BoundedQueue : public QueueBase {
+public:
+    // The capacity is rounded up to a power of two, and to at least 2 since
+    // the sequence numbers of a single cell cannot tell full from empty.
+    explicit BoundedQueue(size_t capacity);
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Moves from `item` only on success.
+    bool try_push(T& item);
+    bool try_pop(T& item);
+
+    // Blocks while the queue is full. Returns false, dropping the item, once
+    // the queue is closed.
+    bool push(T item);
+    // Blocks while the queue is empty. Returns false once the queue is closed
+    // and drained.
+    bool pop(T& item);
+
+    // Wakes every blocked caller. Items already queued can still be popped.
+    void close() override;
+    bool closed() const { return closed_.load(); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    template <typename Ready>
+    void sleep_until(Ready ready);
+    void wake();
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> sleepers_{0};
+    std::atomic<bool> closed_{false};
+    std::mutex mutex_;
+    std::condition_variable changed_;
+};
+
+// Chain of stages running on their own threads and connected by bounded
+// queues: a source, any number of stages and a sink. Items are moved from
+// queue to queue, so passing a std::unique_ptr to a batch hands the batch on
+// without copying it. A stage closes its output queue once all of its threads
+// are done, and the first exception thrown by any stage closes every queue and
+// is rethrown by wait().
+class Pipeline {
+public:
+    Pipeline() = default;
+    // Cancels and joins whatever is still running.
+    ~Pipeline();
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    template <typename T>
+    BoundedQueue<T>& queue(size_t capacity);
+
+    // Calls produce(item) on one thread and pushes each item to `out` until
+    // it returns false.
+    template <typename Out, typename Produce>
+    void source(BoundedQueue<Out>& out, Produce produce);
+
+    // Pushes fn(std::move(item)) to `out` for every item of `in`, on `threads`
+    // threads that each run their own copy of `fn`. Items can leave in a
+    // different order than they came in.
+    template <typename In, typename Out, typename Fn>
+    void stage(BoundedQueue<In>& in, BoundedQueue<Out>& out, size_t threads, Fn fn);
+
+    // Calls consume(std::move(item)) for every item of `in`, on one thread.
+    template <typename In, typename Consume>
+    void sink(BoundedQueue<In>& in, Consume consume);
+
+    // Waits for every stage to finish and rethrows the first error.
+    void wait();
+
+private:
+    void spawn(size_t threads, std::function<void()> body, QueueBase* output);
+    void fail(std::exception_ptr error);
+
+    std::vector<std::unique_ptr<QueueBase>> queues_;
+    std::vector<std::thread> threads_;
+    // Guards queues_ and error_.
+    std::mutex mutex_;
+    std::exception_ptr error_;
+};
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    cells_ = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    mask_ = size - 1;
+}
+
+template <typename T>
+bool BoundedQueue<T>::try_push(T& item) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        const intptr_t diff = intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(pos);
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::try_pop(T& item) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        const intptr_t diff = intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+    item = std::move(cell->value);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::push(T item) {
+    while (!closed_.load()) {
+        if (try_push(item)) {
+            wake();
+            return true;
+        }
+        sleep_until([this] { return tail_.load() - head_.load() <= mask_; });
+    }
+    return false;
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop(T& item) {
+    while (true) {
+        if (try_pop(item)) {
+            wake();
+            return true;
+        }
+        if (closed_.load()) return try_pop(item);
+        sleep_until([this] { return tail_.load() != head_.load(); });
+    }
+}
+
+template <typename T>
+void BoundedQueue<T>::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_.store(true);
+    }
+    changed_.notify_all();
+}
+
+// A sleeper registers before it re-checks the queue and a waker checks for
+// sleepers after it changed the queue, so one of them always sees the other.
+template <typename T>
+template <typename Ready>
+void BoundedQueue<T>::sleep_until(Ready ready) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    changed_.wait(lock, [&] { return closed_.load() || ready(); });
+    sleepers_.fetch_sub(1);
+}
+
+template <typename T>
+void BoundedQueue<T>::wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load() == 0) return;
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    changed_.notify_all();
+}
+
+template <typename T>
+BoundedQueue<T>& Pipeline::queue(size_t capacity) {
+    auto queue = std::make_unique<BoundedQueue<T>>(capacity);
+    BoundedQueue<T>& ref = *queue;
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_.push_back(std::move(queue));
+    return ref;
+}
+
+template <typename Out, typename Produce>
+void Pipeline::source(BoundedQueue<Out>& out, Produce produce) {
+    spawn(1, [&out, produce]() mutable {
+        Out item;
+        while (produce(item) && out.push(std::move(item))) {
+            item = Out();
+        }
+    }, &out);
+}
+
+template <typename In, typename Out, typename Fn>
+void Pipeline::stage(BoundedQueue<In>& in, BoundedQueue<Out>& out, size_t threads, Fn fn) {
+    spawn(std::max<size_t>(threads, 1), [&in, &out, fn]() mutable {
+        In item;
+        while (in.pop(item)) {
+            if (!out.push(fn(std::move(item)))) return;
+        }
+    }, &out);
+}
+
+template <typename In, typename Consume>
+void Pipeline::sink(BoundedQueue<In>& in, Consume consume) {
+    spawn(1, [&in, consume]() mutable {
+        In item;
+        while (in.pop(item)) consume(std::move(item));
+    }, nullptr);
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "reference_cache.hpp"
+
+namespace {
+
+// Query bytes the profile scores: every letter, as for the simple AAMatrix.
+constexpr std::string_view kProfileOrder = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+}
+
+ReferenceWindowCache::Window::Window(std::string_view ref, size_t block_size, bool reversed, const AlignmentScoring& scoring_params)
+    : bases_(ref), block_size_(block_size), reversed_(reversed), scoring_(scoring_params) {
+    padded_ = block_new_padded_aa(ref.length(), block_size);
+    if (reversed) {
+        block_set_bytes_rev_padded_aa(padded_, reinterpret_cast<const uint8_t*>(ref.data()), ref.length(), block_size);
+    } else {
+        block_set_bytes_padded_aa(padded_, reinterpret_cast<const uint8_t*>(ref.data()), ref.length(), block_size);
+    }
+
+    std::vector<int8_t> scores(ref.length() * kProfileOrder.length());
+    for (size_t i = 0; i < ref.length(); ++i) {
+        const char base = static_cast<char>(std::toupper(static_cast<unsigned char>(ref[i])));
+        for (size_t j = 0; j < kProfileOrder.length(); ++j) {
+            scores[i * kProfileOrder.length() + j] = kProfileOrder[j] == base ? scoring_params.match : scoring_params.mismatch;
+        }
+    }
+    profile_ = block_new_aaprofile(ref.length(), block_size, scoring_params.gap_extend);
+    const uint8_t* order = reinterpret_cast<const uint8_t*>(kProfileOrder.data());
+    if (reversed) {
+        block_set_all_rev_aaprofile(profile_, order, kProfileOrder.length(), scores.data(), scores.size(), 0, 0);
+    } else {
+        block_set_all_aaprofile(profile_, order, kProfileOrder.length(), scores.data(), scores.size(), 0, 0);
+    }
+    // Same affine gaps as Gaps{gap_open, gap_extend} in the matrix kernels.
+    block_set_all_gap_open_C_aaprofile(profile_, scoring_params.gap_open);
+    block_set_all_gap_close_C_aaprofile(profile_, 0);
+    block_set_all_gap_open_R_aaprofile(profile_, scoring_params.gap_open);
+}
+
+ReferenceWindowCache::Window::~Window() {
+    if (profile_) block_free_aaprofile(profile_);
+    if (padded_) block_free_padded_aa(padded_);
+}
+
+// Approximate: the profile keeps a score per letter and three gap costs per
+// column, padded by a block on the right.
+size_t ReferenceWindowCache::Window::memory_bytes() const {
+    const size_t columns = bases_.length() + block_size_ + 1;
+    return sizeof(Window) + bases_.capacity() + (bases_.length() + 2 * block_size_) + columns * (kProfileOrder.length() + 3);
+}
+
+ReferenceWindowCache::ReferenceWindowCache(size_t capacity_bytes, size_t shard_count)
+    : shards_(std::max<size_t>(shard_count, 1)), shard_capacity_(capacity_bytes / shards_.size()) {}
+
+uint64_t ReferenceWindowCache::Lookup::key() const {
+    uint64_t key = sequence == kContentKeyed ? std::hash<std::string_view>()(ref) : sequence;
+    const uint64_t params[] = {offset, ref.length(), block_size, reversed,
+                               uint64_t(uint8_t(scoring.match)) | uint64_t(uint8_t(scoring.mismatch)) << 8 |
+                               uint64_t(uint8_t(scoring.gap_open)) << 16 | uint64_t(uint8_t(scoring.gap_extend)) << 24};
+    for (uint64_t param : params) {
+        key ^= param + 0x9e3779b97f4a7c15ULL + (key << 6) + (key >> 2);
+    }
+    return key;
+}
+
+bool ReferenceWindowCache::Lookup::matches(const Window& window) const {
+    if (window.sequence_ != sequence || window.offset_ != offset || window.bases_.length() != ref.length() ||
+        window.block_size_ != block_size || window.reversed_ != reversed || window.scoring_.match != scoring.match ||
+        window.scoring_.mismatch != scoring.mismatch || window.scoring_.gap_open != scoring.gap_open ||
+        window.scoring_.gap_extend != scoring.gap_extend) {
+        return false;
+    }
+    if (sequence == kContentKeyed) return window.bases_ == ref;
+#ifndef NDEBUG
+    if (window.bases_ != ref) {
+        throw std::logic_error("reference window cache: different bases at the same position of sequence " + std::to_string(sequence));
+    }
+#endif
+    return true;
+}
+
+std::shared_ptr<const ReferenceWindowCache::Window> ReferenceWindowCache::find(Shard& shard, uint64_t key, const Lookup& lookup) {
+    auto [begin, end] = shard.index.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+        if (lookup.matches(*it->second->second)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const ReferenceWindowCache::Window> ReferenceWindowCache::get(
+    std::string_view ref, const ReferenceOrigin* origin, size_t block_size, bool reversed, const AlignmentScoring& scoring_params) {
+    const Lookup lookup = {ref,
+                           origin ? origin->sequence : kContentKeyed,
+                           origin ? origin->offset + static_cast<uint64_t>(ref.data() - origin->bases.data()) : 0,
+                           block_size, reversed, scoring_params};
+    const uint64_t key = lookup.key();
+    Shard& s = shard(key);
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (auto window = find(s, key, lookup)) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return window;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    auto built = std::make_shared<Window>(ref, block_size, reversed, scoring_params);
+    built->sequence_ = lookup.sequence;
+    built->offset_ = lookup.offset;
+    const size_t bytes = built->memory_bytes();
+    if (bytes > shard_capacity_) return built;
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    // Another worker may have built the same window in the meantime.
+    if (auto window = find(s, key, lookup)) return window;
+    s.lru.emplace_front(key, built);
+    s.index.emplace(key, s.lru.begin());
+    s.bytes += bytes;
+    while (s.bytes > shard_capacity_) {
+        const auto oldest = std::prev(s.lru.end());
+        auto [first, last] = s.index.equal_range(oldest->first);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == oldest) {
+                s.index.erase(it);
+                break;
+            }
+        }
+        s.bytes -= oldest->second->memory_bytes();
+        s.lru.pop_back();
+    }
+    return built;
+}
+
+size_t ReferenceWindowCache::memory_bytes() const {
+    size_t bytes = 0;
+    for (const Shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        bytes += s.bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,102 @@
+#ifndef REFERENCE_WINDOW_CACHE_H
+#define REFERENCE_WINDOW_CACHE_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "baligner.hpp"
+
+// Reference windows ready for block-aligner: the padded bytes and a scoring
+// profile of the window, built once and shared by every read that aligns to
+// the same bases with the same block size, direction and scoring. A window
+// whose ReferenceOrigin is known is keyed by its position (sequence, offset,
+// length), so a window unpacked into reused scratch memory still hits without
+// its bases being hashed; other windows are keyed by their content. The cache
+// is split into shards, each with its own lock and least-recently-used
+// eviction once it holds more than its share of `capacity_bytes`. All methods
+// are thread-safe; one cache is meant to be shared by all workers through
+// AlignmentPolicy::reference_cache.
+class ReferenceWindowCache {
+public:
+    // Immutable once built. A window evicted while a worker still aligns
+    // against it stays alive until that worker lets go of it.
+    class Window {
+    public:
+        Window(std::string_view ref, size_t block_size, bool reversed, const AlignmentScoring& scoring_params);
+        ~Window();
+        Window(const Window&) = delete;
+        Window& operator=(const Window&) = delete;
+
+        const PaddedBytes* padded() const { return padded_; }
+        const AAProfile* profile() const { return profile_; }
+        size_t memory_bytes() const;
+
+    private:
+        friend class ReferenceWindowCache;
+
+        std::string bases_;
+        size_t block_size_;
+        bool reversed_;
+        AlignmentScoring scoring_;
+        // Position of the bases, or kContentKeyed for a window found by them.
+        uint64_t sequence_ = kContentKeyed;
+        uint64_t offset_ = 0;
+        PaddedBytes* padded_ = nullptr;
+        AAProfile* profile_ = nullptr;
+    };
+
+    explicit ReferenceWindowCache(size_t capacity_bytes = size_t(256) << 20, size_t shard_count = 16);
+    ReferenceWindowCache(const ReferenceWindowCache&) = delete;
+    ReferenceWindowCache& operator=(const ReferenceWindowCache&) = delete;
+
+    // Window of `ref` for blocks of up to `block_size`, reversed for aligning
+    // backwards. `origin`, when not null, contains `ref` and gives its
+    // position. Built outside the lock on a miss.
+    std::shared_ptr<const Window> get(std::string_view ref, const ReferenceOrigin* origin, size_t block_size, bool reversed,
+                                      const AlignmentScoring& scoring_params);
+
+    size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    size_t memory_bytes() const;
+
+private:
+    static constexpr uint64_t kContentKeyed = ~uint64_t(0);
+
+    // What a window is looked up by: its position when sequence is not
+    // kContentKeyed, otherwise its bases.
+    struct Lookup {
+        std::string_view ref;
+        uint64_t sequence;
+        uint64_t offset;
+        size_t block_size;
+        bool reversed;
+        const AlignmentScoring& scoring;
+
+        uint64_t key() const;
+        bool matches(const Window& window) const;
+    };
+    using Entry = std::pair<uint64_t, std::shared_ptr<const Window>>;
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> lru;
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    static std::shared_ptr<const Window> find(Shard& shard, uint64_t key, const Lookup& lookup);
+    Shard& shard(uint64_t key) { return shards_[key % shards_.size()]; }
+
+    std::vector<Shard> shards_;
+    size_t shard_capacity_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sequence_io.hpp"
+
+MappedFile::MappedFile(const std::string& path, MapAdvice advice) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+        void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("cannot mmap " + path + ": " + std::strerror(errno));
+        }
+        data_ = static_cast<char*>(mapped);
+        madvise(data_, size_, advice == MapAdvice::Random ? MADV_RANDOM : MADV_NORMAL);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) munmap(data_, size_);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        if (data_) munmap(data_, size_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+namespace {
+
+bool file_exists(const std::string& path) {
+    return access(path.c_str(), R_OK) == 0;
+}
+
+}
+
+// With a .fai the bases are only ever read at random, for windows; the scan
+// without one reads the file front to back once.
+MappedReference::MappedReference(const std::string& path)
+    : file_(path, file_exists(path + ".fai") ? MapAdvice::Random : MapAdvice::Normal) {
+    if (file_exists(path + ".fai")) {
+        read_fai(path, path + ".fai");
+    } else {
+        scan_layout(path);
+    }
+}
+
+// Lines are name, length, offset, line_bases and line_width, tab-separated.
+// Each contig is checked against the size of the FASTA and must start right
+// after a line break, which catches most stale or foreign indexes.
+void MappedReference::read_fai(const std::string& path, const std::string& fai_path) {
+    std::vector<size_t> name_ends;
+    LineReader lines(fai_path);
+    std::string_view line;
+    while (lines.next(line)) {
+        if (line.empty()) continue;
+        const size_t tab = line.find('\t');
+        if (tab == std::string_view::npos) {
+            throw std::runtime_error(fai_path + ": malformed line");
+        }
+        fai_names_.append(line.substr(0, tab));
+        name_ends.push_back(fai_names_.size());
+        line.remove_prefix(tab + 1);
+
+        size_t fields[4];
+        for (size_t& field : fields) {
+            auto [ptr, ec] = std::from_chars(line.data(), line.data() + line.size(), field);
+            if (ec != std::errc() || (ptr != line.data() + line.size() && *ptr != '\t')) {
+                throw std::runtime_error(fai_path + ": malformed line");
+            }
+            line.remove_prefix(std::min(line.size(), size_t(ptr - line.data()) + 1));
+        }
+        MappedContig contig = {{}, fields[0], fields[1], fields[2], fields[3]};
+        if (contig.length > 0) {
+            if (contig.line_bases == 0 || contig.line_width < contig.line_bases || contig.offset == 0 ||
+                contig.offset >= file_.size() || file_.data()[contig.offset - 1] != '\n') {
+                throw std::runtime_error(fai_path + " does not match " + path);
+            }
+            const size_t last = contig.length - 1;
+            const size_t last_line = last / contig.line_bases;
+            if (last_line > (file_.size() - contig.offset) / contig.line_width ||
+                contig.offset + last_line * contig.line_width + last % contig.line_bases >= file_.size()) {
+                throw std::runtime_error(fai_path + " does not match " + path);
+            }
+        }
+        contigs_.push_back(contig);
+    }
+    // Names are viewed once the buffer has stopped growing.
+    size_t name_begin = 0;
+    for (size_t c = 0; c < contigs_.size(); ++c) {
+        contigs_[c].name = std::string_view(fai_names_).substr(name_begin, name_ends[c] - name_begin);
+        name_begin = name_ends[c];
+    }
+}
+
+void MappedReference::scan_layout(const std::string& path) {
+    const char* data = file_.data();
+    const size_t size = file_.size();
+    size_t pos = 0;
+
+    while (pos < size) {
+        if (data[pos] != '>') {
+            const char* line_end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+            pos = line_end ? line_end - data + 1 : size;
+            continue;
+        }
+        size_t name_begin = pos + 1;
+        size_t name_end = name_begin;
+        while (name_end < size && data[name_end] != '\n' && data[name_end] != ' ' && data[name_end] != '\t' && data[name_end] != '\r') {
+            name_end++;
+        }
+        const char* header_end = static_cast<const char*>(std::memchr(data + name_end, '\n', size - name_end));
+        pos = header_end ? header_end - data + 1 : size;
+
+        // The first line sets the layout. A shorter line, or one laid out
+        // differently, must be the last line with bases.
+        MappedContig contig = {std::string_view(data + name_begin, name_end - name_begin), 0, pos, 0, 0};
+        bool ended = false;
+        while (pos < size && data[pos] != '>') {
+            const char* line_end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+            const size_t end = line_end ? line_end - data : size;
+            const size_t next = line_end ? end + 1 : size;
+            size_t len = end - pos;
+            if (len > 0 && data[end - 1] == '\r') len--;
+            if (len == 0) {
+                ended = contig.length > 0;
+            } else if (ended || (contig.length > 0 && len > contig.line_bases)) {
+                throw std::runtime_error(path + ": lines of contig '" + std::string(contig.name) + "' differ in length");
+            } else {
+                if (contig.length == 0) {
+                    contig.offset = pos;
+                    contig.line_bases = len;
+                    contig.line_width = next - pos;
+                }
+                ended = len < contig.line_bases || next - pos != contig.line_width;
+                contig.length += len;
+            }
+            pos = next;
+        }
+        contigs_.push_back(contig);
+    }
+}
+
+const MappedContig* MappedReference::find(std::string_view name) const {
+    for (const auto& contig : contigs_) {
+        if (contig.name == name) return &contig;
+    }
+    return nullptr;
+}
+
+std::string_view MappedReference::bases(const MappedContig& contig, size_t pos, size_t len, std::string& buffer) const {
+    pos = std::min(pos, contig.length);
+    len = std::min(len, contig.length - pos);
+    if (len == 0) return {};
+    const char* data = file_.data() + contig.offset;
+    size_t line = pos / contig.line_bases;
+    size_t column = pos % contig.line_bases;
+    if (column + len <= contig.line_bases) return std::string_view(data + line * contig.line_width + column, len);
+
+    buffer.clear();
+    while (buffer.size() < len) {
+        buffer.append(data + line * contig.line_width + column, std::min(contig.line_bases - column, len - buffer.size()));
+        line++;
+        column = 0;
+    }
+    return buffer;
+}
+
+LineReader::LineReader(const std::string& path, size_t chunk_size) : chunk_(chunk_size) {
+    fd_ = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+LineReader::~LineReader() {
+    if (fd_ > STDIN_FILENO) close(fd_);
+}
+
+bool LineReader::fill() {
+    if (eof_) return false;
+    ssize_t n;
+    do {
+        n = read(fd_, chunk_.data(), chunk_.size());
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+    }
+    chunk_pos_ = 0;
+    chunk_len_ = n;
+    eof_ = n == 0;
+    return !eof_;
+}
+
+// Only a line that straddles two chunks is stitched together in carry_.
+bool LineReader::next(std::string_view& line) {
+    carry_.clear();
+    while (true) {
+        if (chunk_pos_ == chunk_len_ && !fill()) {
+            if (carry_.empty()) return false;
+            line = carry_;
+            break;
+        }
+        const char* begin = chunk_.data() + chunk_pos_;
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', chunk_len_ - chunk_pos_));
+        if (!newline) {
+            carry_.append(begin, chunk_len_ - chunk_pos_);
+            chunk_pos_ = chunk_len_;
+            continue;
+        }
+        size_t len = newline - begin;
+        chunk_pos_ += len + 1;
+        if (carry_.empty()) {
+            line = std::string_view(begin, len);
+        } else {
+            carry_.append(begin, len);
+            line = carry_;
+        }
+        break;
+    }
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    return true;
+}
+
+FastxReader::FastxReader(const std::string& path, size_t chunk_size) : lines_(path, chunk_size) {}
+
+bool FastxReader::next(FastxRecord& record) {
+    std::string_view line;
+    while (header_.empty()) {
+        if (!lines_.next(line)) return false;
+        if (!line.empty() && (line[0] == '>' || line[0] == '@')) header_.assign(line);
+    }
+
+    const char kind = header_[0];
+    size_t name_end = header_.find_first_of(" \t", 1);
+    name_.assign(header_, 1, name_end == std::string::npos ? std::string::npos : name_end - 1);
+    header_.clear();
+    sequence_.clear();
+    quality_.clear();
+
+    if (kind == '>') {
+        while (lines_.next(line)) {
+            if (line.empty()) continue;
+            if (line[0] == '>') {
+                header_.assign(line);
+                break;
+            }
+            sequence_.append(line);
+        }
+    } else {
+        while (lines_.next(line) && (line.empty() || line[0] != '+')) {
+            sequence_.append(line);
+        }
+        while (quality_.size() < sequence_.size() && lines_.next(line)) {
+            quality_.append(line);
+        }
+    }
+
+    record.name = name_;
+    record.sequence = sequence_;
+    record.quality = quality_;
+    return true;
+}
+
+size_t fill_read_batch(FastxReader& reader, ReadBatch& batch, size_t max_reads) {
+    batch.bases.clear();
+    batch.offsets.clear();
+    batch.names.clear();
+    batch.sequences.clear();
+    batch.qualities.clear();
+
+    // Views are taken only once all records are copied, since appending may
+    // move the buffer.
+    FastxRecord record;
+    while (batch.offsets.size() / 3 < max_reads && reader.next(record)) {
+        batch.offsets.push_back(batch.bases.size());
+        batch.bases.append(record.name);
+        batch.offsets.push_back(batch.bases.size());
+        batch.bases.append(record.sequence);
+        batch.offsets.push_back(batch.bases.size());
+        batch.bases.append(record.quality);
+    }
+    size_t count = batch.offsets.size() / 3;
+    batch.offsets.push_back(batch.bases.size());
+
+    std::string_view bases = batch.bases;
+    for (size_t i = 0; i < count; i++) {
+        const size_t* field = &batch.offsets[3 * i];
+        batch.names.push_back(bases.substr(field[0], field[1] - field[0]));
+        batch.sequences.push_back(bases.substr(field[1], field[2] - field[1]));
+        batch.qualities.push_back(bases.substr(field[2], field[3] - field[2]));
+    }
+    return count;
+}
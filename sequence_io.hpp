@@ -0,0 +1,142 @@
+#ifndef SEQUENCE_IO_H
+#define SEQUENCE_IO_H
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// How a MappedFile will be read, passed on to the kernel as a madvise hint.
+enum class MapAdvice {
+    // Scattered lookups: no read-ahead.
+    Random,
+    // The kernel's default read-ahead.
+    Normal,
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const std::string& path, MapAdvice advice);
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct Contig {
+    std::string_view name;
+    std::string_view sequence;
+};
+
+// A contig of a MappedReference, laid out as in a .fai index: its bases start
+// at `offset` in the file, `line_bases` to a line, and a full line takes
+// `line_width` bytes with its line break.
+struct MappedContig {
+    std::string_view name;
+    size_t length;
+    size_t offset;
+    size_t line_bases;
+    size_t line_width;
+};
+
+// FASTA reference on a read-only memory mapping. Only the layout of each
+// contig is kept, and bases are read from the mapping on demand: a span
+// within one line is used in place, and only a span across line breaks is
+// copied out. The layout comes from `path`.fai when there is one, so opening
+// the reference reads none of it; otherwise the whole file is scanned once.
+// As with samtools faidx, all lines of a contig but its last must hold the
+// same number of bases.
+class MappedReference {
+public:
+    explicit MappedReference(const std::string& path);
+
+    const std::vector<MappedContig>& contigs() const { return contigs_; }
+    const MappedContig* find(std::string_view name) const;
+
+    // Bases [pos, pos + len) of `contig`, clamped to its end. A span that
+    // crosses a line break is copied into `buffer`, and the view then points
+    // there.
+    std::string_view bases(const MappedContig& contig, size_t pos, size_t len, std::string& buffer) const;
+
+private:
+    void read_fai(const std::string& path, const std::string& fai_path);
+    void scan_layout(const std::string& path);
+
+    MappedFile file_;
+    std::vector<MappedContig> contigs_;
+    // Contig names read from a .fai, which the contig views point into.
+    std::string fai_names_;
+};
+
+// Reads a file line by line through one reusable chunk buffer. Lines that fit
+// in the chunk are returned as views into it; the view stays valid until the
+// next call. A path of "-" reads standard input.
+class LineReader {
+public:
+    explicit LineReader(const std::string& path, size_t chunk_size = 1 << 20);
+    ~LineReader();
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    bool next(std::string_view& line);
+
+private:
+    bool fill();
+
+    int fd_ = -1;
+    std::vector<char> chunk_;
+    size_t chunk_pos_ = 0;
+    size_t chunk_len_ = 0;
+    bool eof_ = false;
+    std::string carry_;
+};
+
+struct FastxRecord {
+    std::string_view name;
+    std::string_view sequence;
+    std::string_view quality;
+};
+
+// Streaming FASTA/FASTQ parser on top of LineReader. The returned record views
+// point into per-field buffers that are reused, so parsing does not allocate
+// once the buffers have grown to the longest record. Record views stay valid
+// until the next call to next().
+class FastxReader {
+public:
+    explicit FastxReader(const std::string& path, size_t chunk_size = 1 << 20);
+
+    bool next(FastxRecord& record);
+
+private:
+    LineReader lines_;
+    std::string header_;
+    std::string name_;
+    std::string sequence_;
+    std::string quality_;
+};
+
+// A batch of reads copied out of a FastxReader into one flat buffer. The
+// buffer is reused from batch to batch, and the views stay valid until the
+// next call to fill_read_batch on the same batch.
+struct ReadBatch {
+    std::string bases;
+    std::vector<size_t> offsets;
+    std::vector<std::string_view> names;
+    std::vector<std::string_view> sequences;
+    std::vector<std::string_view> qualities;
+
+    size_t size() const { return sequences.size(); }
+};
+
+size_t fill_read_batch(FastxReader& reader, ReadBatch& batch, size_t max_reads);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SEQUENCE_VIEW_H
+#define SEQUENCE_VIEW_H
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+
+// Watson-Crick complement of an ASCII base, keeping its case. Anything other
+// than A/C/G/T becomes N.
+inline char complement_base(char base) {
+    switch (base) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        case 'a': return 't';
+        case 'c': return 'g';
+        case 'g': return 'c';
+        case 't': return 'a';
+        case 'n': return 'n';
+        default: return 'N';
+    }
+}
+
+// Reverse complement of a sequence, read through the forward bases. Position
+// 0 is the complement of the last forward base. Nothing is copied until bases
+// are written out with copy().
+class ReverseComplementView {
+public:
+    explicit ReverseComplementView(std::string_view forward) : forward_(forward) {}
+
+    size_t length() const { return forward_.length(); }
+    char operator[](size_t pos) const { return complement_base(forward_[forward_.length() - 1 - pos]); }
+
+    // Bases [pos, pos + len) of the reverse complement, clamped like
+    // std::string_view::substr.
+    ReverseComplementView substr(size_t pos, size_t len) const {
+        len = std::min(len, forward_.length() - pos);
+        return ReverseComplementView(forward_.substr(forward_.length() - pos - len, len));
+    }
+
+    // The forward bases this view reads.
+    std::string_view forward() const { return forward_; }
+
+    // Writes the whole view to `out`, complementing on the way.
+    void copy(char* out) const {
+        for (size_t i = forward_.length(); i > 0; --i) *out++ = complement_base(forward_[i - 1]);
+    }
+
+private:
+    std::string_view forward_;
+};
+
+#endif
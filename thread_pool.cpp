@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include "thread_pool.hpp"
+
+namespace {
+
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    queues_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        threads_.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(TaskGroup& group, Task task) {
+    group.pending++;
+    size_t target = current_pool == this ? current_worker : next_queue_++ % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        queues_[target]->jobs.push_back({std::move(task), &group});
+        queued_++;
+    }
+    // Taking the wake mutex orders the notify after any worker that is between
+    // checking queued_ and going to sleep.
+    { std::lock_guard<std::mutex> lock(wake_mutex_); }
+    wake_.notify_one();
+}
+
+bool WorkStealingPool::try_pop(size_t worker, Job& job) {
+    {
+        Queue& own = *queues_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < queues_.size(); offset++) {
+        Queue& victim = *queues_[(worker + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(Job& job, size_t worker) {
+    try {
+        job.task(worker);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(job.group->error_mutex);
+        if (!job.group->error) job.group->error = std::current_exception();
+    }
+    if (--job.group->pending == 0) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        done_.notify_all();
+    }
+}
+
+void WorkStealingPool::worker_loop(size_t worker) {
+    current_pool = this;
+    current_worker = worker;
+    while (true) {
+        Job job;
+        if (try_pop(worker, job)) {
+            run(job, worker);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+void WorkStealingPool::wait(TaskGroup& group) {
+    if (current_pool == this) {
+        while (group.pending > 0) {
+            Job job;
+            if (try_pop(current_worker, job)) {
+                run(job, current_worker);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        done_.wait(lock, [&group] { return group.pending == 0; });
+    }
+    std::lock_guard<std::mutex> lock(group.error_mutex);
+    if (group.error) std::rethrow_exception(std::exchange(group.error, nullptr));
+}
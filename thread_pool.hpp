@@ -0,0 +1,71 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a set of submitted tasks so that a caller can wait for just those.
+// The first exception thrown by one of them is kept for wait() to rethrow.
+struct TaskGroup {
+    std::atomic<size_t> pending{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+// Fixed-size pool where every worker owns a task deque. Workers pop their own
+// newest task first and, when idle, steal the oldest task of another worker,
+// so uneven task sizes (e.g. 150 bp next to 100 kb reads) do not leave cores
+// idle. Tasks receive the index of the worker running them, which callers use
+// to pick per-worker state such as a BlockAlignerWorkspace.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(size_t worker)>;
+
+    explicit WorkStealingPool(size_t threads = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t size() const { return queues_.size(); }
+
+    // Tasks submitted from a worker go to that worker's own deque; others are
+    // spread round-robin.
+    void submit(TaskGroup& group, Task task);
+
+    // Blocks until every task of `group` has finished, then rethrows the first
+    // exception any of them threw. When called from one of the pool's
+    // workers, it keeps running queued tasks while waiting.
+    void wait(TaskGroup& group);
+
+private:
+    struct Job {
+        Task task;
+        TaskGroup* group;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    bool try_pop(size_t worker, Job& job);
+    void run(Job& job, size_t worker);
+    void worker_loop(size_t worker);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> next_queue_{0};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stopping_ = false;
+};
+
+#endif